@@ -1,184 +1,452 @@
 
 #include "classAttrRoutines.h"
+#include "devroutines.h"
 
-static ssize_t display_show(struct class *cls, struct class_attribute *attr, char *buf);
-static ssize_t display_store(struct class *cls, struct class_attribute *attr,const char *buf, size_t count);
+static ssize_t display_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t display_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count);
 
-static ssize_t blink_show(struct class *cls, struct class_attribute *attr, char *buf);
-static ssize_t blink_store(struct class *cls, struct class_attribute *attr,const char *buf, size_t count);
+static ssize_t blink_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t blink_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count);
 
-static ssize_t cursor_show(struct class *cls, struct class_attribute *attr, char *buf);
-static ssize_t cursor_store(struct class *cls, struct class_attribute *attr,const char *buf, size_t count);
+static ssize_t cursor_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t cursor_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count);
 
-static ssize_t position_show(struct class *cls, struct class_attribute *attr, char *buf);
-static ssize_t position_store(struct class *cls, struct class_attribute *attr,const char *buf, size_t count);
+static ssize_t position_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t position_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count);
 
-static ssize_t autoscroll_show(struct class *cls, struct class_attribute *attr, char *buf);
-static ssize_t autoscroll_store(struct class *cls, struct class_attribute *attr,const char *buf, size_t count);
+static ssize_t autoscroll_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t autoscroll_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count);
 
-static ssize_t textflow_show(struct class *cls, struct class_attribute *attr, char *buf);
-static ssize_t textflow_store(struct class *cls, struct class_attribute *attr,const char *buf, size_t count);
+static ssize_t textflow_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t textflow_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count);
 
-static ssize_t scroll_show(struct class *cls, struct class_attribute *attr, char *buf);
-static ssize_t scroll_store(struct class *cls, struct class_attribute *attr,const char *buf, size_t count);
+static ssize_t scroll_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t scroll_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count);
+
+static ssize_t busstat_show(struct device *dev, struct device_attribute *attr, char *buf);
+
+static ssize_t max_fps_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t max_fps_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count);
+
+static ssize_t timing_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t timing_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count);
+
+static ssize_t marquee_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t marquee_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count);
+
+static ssize_t marquee_speed_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t marquee_speed_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count);
+
+static ssize_t state_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t state_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count);
+
+static ssize_t resync_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t resync_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count);
+
+static ssize_t scrub_show(struct device *dev, struct device_attribute *attr, char *buf);
+static ssize_t scrub_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count);
 
 // helper functions
+static struct lcd *dev_to_lcd(struct device *dev);
+static void dev_to_state(struct device *dev, struct lcd_state *state);
 static ssize_t show_on_off(bool isOn, char *buf);
-static ssize_t exec_on_off(void (*exec_on)(void), void (*exec_off)(void), const char *buf, size_t count);
+static ssize_t exec_on_off(struct device *dev, void (*exec_on)(struct lcd *), void (*exec_off)(struct lcd *), const char *buf, size_t count);
 static ssize_t show_right_left(bool isRight, char *buf);
-static ssize_t exec_right_left(void (*exec_right)(void), void (*exec_left)(void), const char *buf, size_t count);
+static ssize_t exec_right_left(struct device *dev, void (*exec_right)(struct lcd *), void (*exec_left)(struct lcd *), const char *buf, size_t count);
+static int copy_arg(const char *buf, size_t count, char *str, size_t size);
+static int parse_position(char *str, u8 *col, u8 *row);
+static int parse_flag(const char *str, const char *on, const char *off, unsigned char flag, unsigned char *flags);
   
-// "static CLASS_ATTR" will be resolved to "static struct class_attribute class_attr_<name>"
-static CLASS_ATTR(display,    S_IRUGO|S_IWUSR, display_show,    display_store);
-static CLASS_ATTR(blink,      S_IRUGO|S_IWUSR, blink_show,      blink_store);
-static CLASS_ATTR(cursor,     S_IRUGO|S_IWUSR, cursor_show,     cursor_store);
-static CLASS_ATTR(position,   S_IRUGO|S_IWUSR, position_show,   position_store);
-static CLASS_ATTR(autoscroll, S_IRUGO|S_IWUSR, autoscroll_show, autoscroll_store);
-static CLASS_ATTR(textflow,   S_IRUGO|S_IWUSR, textflow_show,   textflow_store);
-static CLASS_ATTR(scroll,     S_IRUGO|S_IWUSR, scroll_show,     scroll_store);
+// "static DEVICE_ATTR" will be resolved to "static struct device_attribute dev_attr_<name>"
+static DEVICE_ATTR(display,    S_IRUGO|S_IWUSR, display_show,    display_store);
+static DEVICE_ATTR(blink,      S_IRUGO|S_IWUSR, blink_show,      blink_store);
+static DEVICE_ATTR(cursor,     S_IRUGO|S_IWUSR, cursor_show,     cursor_store);
+static DEVICE_ATTR(position,   S_IRUGO|S_IWUSR, position_show,   position_store);
+static DEVICE_ATTR(autoscroll, S_IRUGO|S_IWUSR, autoscroll_show, autoscroll_store);
+static DEVICE_ATTR(textflow,   S_IRUGO|S_IWUSR, textflow_show,   textflow_store);
+static DEVICE_ATTR(scroll,     S_IRUGO|S_IWUSR, scroll_show,     scroll_store);
+static DEVICE_ATTR(busstat,    S_IRUGO,         busstat_show,    NULL);
+static DEVICE_ATTR(max_fps,    S_IRUGO|S_IWUSR, max_fps_show,    max_fps_store);
+static DEVICE_ATTR(timing,     S_IRUGO|S_IWUSR, timing_show,     timing_store);
+static DEVICE_ATTR(marquee,    S_IRUGO|S_IWUSR, marquee_show,    marquee_store);
+static DEVICE_ATTR(marquee_speed, S_IRUGO|S_IWUSR, marquee_speed_show, marquee_speed_store);
+static DEVICE_ATTR(state,      S_IRUGO|S_IWUSR, state_show,      state_store);
+static DEVICE_ATTR(resync,     S_IRUGO|S_IWUSR, resync_show,     resync_store);
+static DEVICE_ATTR(scrub,      S_IRUGO|S_IWUSR, scrub_show,      scrub_store);
+
+static struct attribute *lcd_attrs[] = {
+  &dev_attr_display.attr,
+  &dev_attr_blink.attr,
+  &dev_attr_cursor.attr,
+  &dev_attr_position.attr,
+  &dev_attr_autoscroll.attr,
+  &dev_attr_textflow.attr,
+  &dev_attr_scroll.attr,
+  &dev_attr_busstat.attr,
+  &dev_attr_max_fps.attr,
+  &dev_attr_timing.attr,
+  &dev_attr_marquee.attr,
+  &dev_attr_marquee_speed.attr,
+  &dev_attr_state.attr,
+  &dev_attr_resync.attr,
+  &dev_attr_scrub.attr,
+  NULL,
+};
+ATTRIBUTE_GROUPS(lcd);
 
 /** 
- *  Initialize sysfs class attributes
+ *  Initialize sysfs attributes, every device of the class gets its own set
+ *  in /sys/class/lcdchar/<device>/
  */
 int  lcdClassAttr_init(struct class *cls){
-  int ret = 0;
+  cls->dev_groups = lcd_groups;
+  return 0;
+}
 
-  ret = class_create_file(cls, &class_attr_display);
-  if(ret) goto lcd_i_exit;
+void lcdClassAttr_destroy(void){
 
-  ret = class_create_file(cls, &class_attr_blink);
-  if(ret) goto lcd_i_exit;
+}
 
-  ret = class_create_file(cls, &class_attr_cursor);
-  if(ret) goto lcd_i_exit;
+// ****** DISPLAY ON/OFF ******
+static ssize_t display_show(struct device *dev, struct device_attribute *attr, char *buf){
+  struct lcd_state state;
+
+  dev_to_state(dev, &state);
+  return show_on_off(state.control & LCD_DISPLAYON, buf);
+}
+static ssize_t display_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count){
+  return exec_on_off(dev, lcd_display, lcd_noDisplay, buf, count);
+}
 
-  ret = class_create_file(cls, &class_attr_position);
-  if(ret) goto lcd_i_exit;
+// ****** BLINK CURSOR ON/OFF ******
+static ssize_t blink_show(struct device *dev, struct device_attribute *attr, char *buf){
+  struct lcd_state state;
 
-  ret = class_create_file(cls, &class_attr_autoscroll);
-  if(ret) goto lcd_i_exit;
+  dev_to_state(dev, &state);
+  return show_on_off(state.control & LCD_BLINKON, buf);
+}
+static ssize_t blink_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count){
+  return exec_on_off(dev, lcd_blink, lcd_noBlink, buf, count);
+}
 
-  ret = class_create_file(cls, &class_attr_textflow);
-  if(ret) goto lcd_i_exit;
-  
-  ret = class_create_file(cls, &class_attr_scroll);
-  if(ret) goto lcd_i_exit;
-  
-  return ret;
+// ****** SHOW CURSOR ON/OFF ******
+static ssize_t cursor_show(struct device *dev, struct device_attribute *attr, char *buf){
+  struct lcd_state state;
 
- lcd_i_exit:
-  printk(KERN_ALERT "Lcd: cannot create attribute file in /sys/class/");
-  return ret;
+  dev_to_state(dev, &state);
+  return show_on_off(state.control & LCD_CURSORON, buf);
+}
+static ssize_t cursor_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count){
+  return exec_on_off(dev, lcd_cursor, lcd_noCursor, buf, count);
 }
 
-void lcdClassAttr_destroy(void){
 
+// ****** SET CURSOR TO POSITION n:n ******
+static ssize_t position_show(struct device *dev, struct device_attribute *attr, char *buf){
+  struct lcd_state state;
+
+  dev_to_state(dev, &state);
+  sprintf(buf, "%d:%d\n", state.col, state.row);
+  return strlen(buf) + 1;
+}
+static ssize_t position_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count){
+  struct lcd_dev *lcddev = dev_get_drvdata(dev);
+  char string[16];
+  u8 col, row;
+
+  if(copy_arg(buf, count, string, sizeof(string)) || parse_position(string, &col, &row)){
+    return -EINVAL;
+  }
+
+  // set cursor to desired position, the flush worker moves the address counter
+  mutex_lock(&lcddev->write_lock);
+  spin_lock(&lcddev->frame_lock);
+  lcd_moveCursor(&lcddev->lcd, col, row);
+  dev_publish(lcddev);
+  spin_unlock(&lcddev->frame_lock);
+  mutex_unlock(&lcddev->write_lock);
+  dev_scheduleFlush(lcddev);
+  return count;
 }
 
-// ****** DISPLAY ON/OFF ******
-static ssize_t display_show(struct class *cls, struct class_attribute *attr, char *buf){
-  return show_on_off(lcd_isDisplayOn(), buf);
+// ****** AUTOSCROLL DISPLAY ENTRY ON/OFF ******
+static ssize_t autoscroll_show(struct device *dev, struct device_attribute *attr, char *buf){
+  struct lcd_state state;
+
+  dev_to_state(dev, &state);
+  return show_on_off(state.mode & LCD_ENTRYSHIFTINCREMENT, buf);
 }
-static ssize_t display_store(struct class *cls, struct class_attribute *attr, const char *buf, size_t count){
-  return exec_on_off(lcd_display, lcd_noDisplay, buf, count);
+static ssize_t autoscroll_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count){
+  return exec_on_off(dev, lcd_autoscroll, lcd_noAutoscroll, buf, count);
 }
 
-// ****** BLINK CURSOR ON/OFF ******
-static ssize_t blink_show(struct class *cls, struct class_attribute *attr, char *buf){
-  return show_on_off(lcd_isBlinkOn(), buf);
+
+// ****** SCROLL DISPLAY ******
+static ssize_t scroll_show(struct device *dev, struct device_attribute *attr, char *buf){
+  strcpy(buf, "left/right\n");
+  return strlen(buf) + 1;
 }
-static ssize_t blink_store(struct class *cls, struct class_attribute *attr, const char *buf, size_t count){
-  return exec_on_off(lcd_blink, lcd_noBlink, buf, count);
+static ssize_t scroll_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count){
+  return exec_right_left(dev, lcd_scrollDisplayRight, lcd_scrollDisplayLeft, buf, count);
 }
 
-// ****** SHOW CURSOR ON/OFF ******
-static ssize_t cursor_show(struct class *cls, struct class_attribute *attr, char *buf){
-  return show_on_off(lcd_isCursorOn(), buf);
+// ****** TEXTFLOW ******
+static ssize_t textflow_show(struct device *dev, struct device_attribute *attr, char *buf){
+  struct lcd_state state;
+
+  dev_to_state(dev, &state);
+  return show_right_left(state.mode & LCD_ENTRYLEFT, buf);
 }
-static ssize_t cursor_store(struct class *cls, struct class_attribute *attr, const char *buf, size_t count){
-  return exec_on_off(lcd_cursor, lcd_noCursor, buf, count);
+static ssize_t textflow_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count){
+  return exec_right_left(dev, lcd_leftToRight, lcd_rightToLeft, buf, count);
 }
 
+// ****** GPIO CALLS OR I2C BYTES PER BYTE SENT, CPU TIME SAVED BY SLEEPING ******
+static ssize_t busstat_show(struct device *dev, struct device_attribute *attr, char *buf){
+  struct lcd_stats stats;
 
-// ****** SET CURSOR TO POSITION n:n ******
-static ssize_t position_show(struct class *cls, struct class_attribute *attr, char *buf){
-  sprintf(buf, "%d:%d\n", lcd_getCursorPosCol(), lcd_getCursorPosRow());
+  lcd_getStats(dev_to_lcd(dev), &stats);
+  sprintf(buf, "%lu gpio calls, %lu bus bytes in %lu transfers for %lu bytes, %lu us slept, %lu us spun\n",
+	  stats.gpio_calls, stats.bus_bytes, stats.transfers, stats.bytes, stats.slept_us, stats.spun_us);
   return strlen(buf) + 1;
 }
-static ssize_t position_store(struct class *cls, struct class_attribute *attr,const char *buf, size_t count){
-  static const char DELIMITERS[] = " \n\r:;,.";
 
-  char *string, *tok, *found;
-  u8 col, row;
+// ****** FLUSHES PER SECOND, 0: NO LIMIT ******
+static ssize_t max_fps_show(struct device *dev, struct device_attribute *attr, char *buf){
+  struct lcd_dev *lcddev = dev_get_drvdata(dev);
 
-  // allocate space for string
-  string = kmalloc(count + 1, GFP_USER);  // GFP_USER from linux/mm.h
-  if(string == NULL) return count;  
+  sprintf(buf, "%u\n", READ_ONCE(lcddev->max_fps));
+  return strlen(buf) + 1;
+}
+static ssize_t max_fps_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count){
+  struct lcd_dev *lcddev = dev_get_drvdata(dev);
+  unsigned int fps;
 
-  string[count] = '\0';
-  
-  printk(KERN_INFO "LCD: count = %d\n", count);
-  
-  // copy buf into string
-  strncpy(string, buf, count);
+  if(kstrtouint(buf, 10, &fps)){
+    return -EINVAL;
+  }
+  WRITE_ONCE(lcddev->max_fps, min(fps, (unsigned int)HZ));
+  return count;
+}
+
+// ****** CONTROLLER EXECUTION TIMES IN US ******
+static ssize_t timing_show(struct device *dev, struct device_attribute *attr, char *buf){
+  struct lcd_timing timing;
+
+  lcd_getTiming(dev_to_lcd(dev), &timing);
+  sprintf(buf, "%s clear=%u home=%u command=%u data=%u pulse=%u\n", timing.name,
+	  timing.clear, timing.home, timing.command, timing.data, timing.pulse);
+  return strlen(buf) + 1;
+}
+// either a controller name or one or more "<class>=<us>" pairs
+static ssize_t timing_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count){
+  static const char DELIMITERS[] = " \n\r,;";
+  struct lcd_dev *lcddev = dev_get_drvdata(dev);
+  const struct lcd_timing *profile;
+  struct lcd_timing timing;
+  char string[96], *tok, *found, *value;
+  unsigned int us;
+  ssize_t ret = count;
+
+  if(copy_arg(buf, count, string, sizeof(string))) return -EINVAL;
+
+  mutex_lock(&lcddev->bus_lock);
+  lcd_getTiming(&lcddev->lcd, &timing);
   tok = string;
+  while((found = strsep(&tok, DELIMITERS)) != NULL){
+    if(*found == '\0') continue;
+
+    value = strchr(found, '=');
+    if(value == NULL){
+      profile = lcd_findTiming(found);
+      if(profile == NULL) { ret = -EINVAL; break; }
+      timing = *profile;
+      continue;
+    }
+    *value++ = '\0';
+    if(kstrtouint(value, 10, &us) || us > 100000) { ret = -EINVAL; break; }
+
+    if(!strcmp(found, "clear")) timing.clear = us;
+    else if(!strcmp(found, "home")) timing.home = us;
+    else if(!strcmp(found, "command")) timing.command = us;
+    else if(!strcmp(found, "data")) timing.data = us;
+    else if(!strcmp(found, "pulse") && us > 0) timing.pulse = us;
+    else { ret = -EINVAL; break; }
+  }
+  if(ret > 0){
+    lcd_setTiming(&lcddev->lcd, &timing);
+  }
+  mutex_unlock(&lcddev->bus_lock);
+  return ret;
+}
 
-  printk(KERN_INFO "LCD: tok = %s\n", tok);
+// ****** MARQUEE "<row>:<text>", ANYTHING ELSE STOPS IT ******
+static ssize_t marquee_show(struct device *dev, struct device_attribute *attr, char *buf){
+  struct lcd_dev *lcddev = dev_get_drvdata(dev);
+  char text[LCD_MARQUEE_MAX + 1];
+  unsigned char row;
+  bool active;
+
+  spin_lock(&lcddev->frame_lock);
+  active = lcd_getMarquee(&lcddev->lcd, &row, text, sizeof(text));
+  spin_unlock(&lcddev->frame_lock);
+  if(active){
+    sprintf(buf, "%u:%s\n", row, text);
+  }
+  else{
+    strcpy(buf, "off\n");
+  }
+  return strlen(buf) + 1;
+}
+static ssize_t marquee_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count){
+  struct lcd_dev *lcddev = dev_get_drvdata(dev);
+  const char *text = strnchr(buf, count, ':');
+  size_t n = 0;
+  u8 row = 0;
+  char digits[4];
+  int ret;
+
+  if(text != NULL && text - buf < sizeof(digits)){
+    memcpy(digits, buf, text - buf);
+    digits[text - buf] = '\0';
+    if(kstrtou8(digits, 10, &row)) return -EINVAL;
+    text++;
+    n = count - (text - buf);
+    if(n > 0 && text[n - 1] == '\n') n--;
+  }
 
-  // get first value
-  found = strsep(&tok, DELIMITERS);
-  printk(KERN_INFO "LCD: found1 = %s\n", found);
-  
-  // convert parsed string to unsigned char
-  if(kstrtou8(found, 10, &col));      // suppress compiler warnig by checking returnvalue
-                                      // on Success: return -> 0;
-                                      // on Error: return -> -EINVAL; col -> 0;
-  printk(KERN_INFO "LCD: col = %d\n", col);
-  
-  found = strsep(&tok, DELIMITERS);
-  printk(KERN_INFO "LCD: found2 = %s\n", found);
-  
-  if(kstrtou8(found, 10, &row));
-  printk(KERN_INFO "LCD: row = %d\n", row);
+  ret = dev_setMarquee(lcddev, row, text, n);
+  return ret ? ret : count;
+}
 
-  
-  
-  // set cursor to desired position 
-  lcd_setCursor(col, row);
+// ****** MARQUEE STEPS PER SECOND ******
+static ssize_t marquee_speed_show(struct device *dev, struct device_attribute *attr, char *buf){
+  struct lcd_dev *lcddev = dev_get_drvdata(dev);
 
-  kfree(string);
-  
+  sprintf(buf, "%u\n", READ_ONCE(lcddev->marquee_speed));
+  return strlen(buf) + 1;
+}
+static ssize_t marquee_speed_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count){
+  struct lcd_dev *lcddev = dev_get_drvdata(dev);
+  unsigned int speed;
+
+  if(kstrtouint(buf, 10, &speed) || speed == 0){
+    return -EINVAL;
+  }
+  WRITE_ONCE(lcddev->marquee_speed, min(speed, (unsigned int)HZ));
   return count;
 }
 
-// ****** AUTOSCROLL DISPLAY ENTRY ON/OFF ******
-static ssize_t autoscroll_show(struct class *cls, struct class_attribute *attr, char *buf){
-  return show_on_off(lcd_isAutoscroll(), buf);
+// ****** ALL SETTINGS AT ONCE, "<key>=<value>" SEPARATED BY BLANKS ******
+static ssize_t state_show(struct device *dev, struct device_attribute *attr, char *buf){
+  struct lcd_state state;
+
+  dev_to_state(dev, &state);
+  sprintf(buf, "display=%s cursor=%s blink=%s autoscroll=%s textflow=%s position=%d:%d\n",
+	  (state.control & LCD_DISPLAYON) ? "on" : "off",
+	  (state.control & LCD_CURSORON) ? "on" : "off",
+	  (state.control & LCD_BLINKON) ? "on" : "off",
+	  (state.mode & LCD_ENTRYSHIFTINCREMENT) ? "on" : "off",
+	  (state.mode & LCD_ENTRYLEFT) ? "right" : "left",
+	  state.col, state.row);
+  return strlen(buf) + 1;
 }
-static ssize_t autoscroll_store(struct class *cls, struct class_attribute *attr,const char *buf, size_t count){
-  return exec_on_off(lcd_autoscroll, lcd_noAutoscroll, buf, count);
+// the whole write is checked first, then at most one control and one entry mode command are sent
+static ssize_t state_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count){
+  static const char DELIMITERS[] = " \n\r;";
+  struct lcd_dev *lcddev = dev_get_drvdata(dev);
+  struct lcd *lcd = &lcddev->lcd;
+  char string[128], *tok, *found, *value;
+  unsigned char control, mode;
+  bool move = false;
+  u8 col = 0, row = 0;
+  int ret = 0;
+
+  if(copy_arg(buf, count, string, sizeof(string))) return -EINVAL;
+
+  mutex_lock(&lcddev->bus_lock);
+  control = lcd_getControl(lcd);
+  mode = lcd_getEntryMode(lcd);
+  tok = string;
+  while(ret == 0 && (found = strsep(&tok, DELIMITERS)) != NULL){
+    if(*found == '\0') continue;
+
+    value = strchr(found, '=');
+    if(value == NULL) { ret = -EINVAL; break; }
+    *value++ = '\0';
+
+    if(!strcmp(found, "display")) ret = parse_flag(value, "on", "off", LCD_DISPLAYON, &control);
+    else if(!strcmp(found, "cursor")) ret = parse_flag(value, "on", "off", LCD_CURSORON, &control);
+    else if(!strcmp(found, "blink")) ret = parse_flag(value, "on", "off", LCD_BLINKON, &control);
+    else if(!strcmp(found, "autoscroll")) ret = parse_flag(value, "on", "off", LCD_ENTRYSHIFTINCREMENT, &mode);
+    else if(!strcmp(found, "textflow")) ret = parse_flag(value, "right", "left", LCD_ENTRYLEFT, &mode);
+    else if(!strcmp(found, "position")) { ret = parse_position(value, &col, &row); move = true; }
+    else ret = -EINVAL;
+  }
+
+  if(ret == 0){
+    if(control != lcd_getControl(lcd)) lcd_setControl(lcd, control);
+    if(mode != lcd_getEntryMode(lcd)) lcd_setEntryMode(lcd, mode);
+    // the cursor moves like in position_store(), not in the middle of a batch
+    mutex_lock(&lcddev->write_lock);
+    spin_lock(&lcddev->frame_lock);
+    if(move) lcd_moveCursor(lcd, col, row);
+    dev_publish(lcddev);
+    spin_unlock(&lcddev->frame_lock);
+    mutex_unlock(&lcddev->write_lock);
+  }
+  mutex_unlock(&lcddev->bus_lock);
+
+  if(ret) return ret;
+  if(move) dev_scheduleFlush(lcddev);
+  return count;
 }
 
+// ****** READ THE DISPLAY BACK AND REPAIR IT, ANY WRITE STARTS IT ******
+static ssize_t resync_show(struct device *dev, struct device_attribute *attr, char *buf){
+  struct lcd_stats stats;
 
-// ****** SCROLL DISPLAY ******
-static ssize_t scroll_show(struct class *cls, struct class_attribute *attr, char *buf){
-  strcpy(buf, "left/right\n");
+  lcd_getStats(dev_to_lcd(dev), &stats);
+  sprintf(buf, "%lu read backs, %lu repairs\n", stats.resyncs, stats.repairs);
   return strlen(buf) + 1;
 }
-static ssize_t scroll_store(struct class *cls, struct class_attribute *attr,const char *buf, size_t count){
-  return exec_right_left(lcd_scrollDisplayRight, lcd_scrollDisplayLeft, buf, count);
+static ssize_t resync_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count){
+  int ret = dev_resync(dev_get_drvdata(dev));
+
+  return (ret < 0) ? ret : count;
 }
 
-// ****** TEXTFLOW ******
-static ssize_t textflow_show(struct class *cls, struct class_attribute *attr, char *buf){
-  return show_right_left(lcd_isLeftToRight(), buf);
+// ****** SECONDS BETWEEN TWO READ BACKS, 0: OFF ******
+static ssize_t scrub_show(struct device *dev, struct device_attribute *attr, char *buf){
+  struct lcd_dev *lcddev = dev_get_drvdata(dev);
+
+  sprintf(buf, "%u\n", READ_ONCE(lcddev->scrub_interval));
+  return strlen(buf) + 1;
 }
-static ssize_t textflow_store(struct class *cls, struct class_attribute *attr,const char *buf, size_t count){
-  return exec_right_left(lcd_leftToRight, lcd_rightToLeft, buf, count);
+static ssize_t scrub_store(struct device *dev, struct device_attribute *attr,const char *buf, size_t count){
+  struct lcd_dev *lcddev = dev_get_drvdata(dev);
+  unsigned int seconds;
+  int ret;
+
+  if(kstrtouint(buf, 10, &seconds) || seconds > 86400){
+    return -EINVAL;
+  }
+  ret = dev_setScrub(lcddev, seconds);
+  return ret ? ret : count;
 }
 
 // ****** HELPER FUNCTIONS ******
 
+static struct lcd *dev_to_lcd(struct device *dev){
+  struct lcd_dev *lcddev = dev_get_drvdata(dev);
+  return &lcddev->lcd;
+}
+
+// the published state, the show functions never wait for a bus transfer
+static void dev_to_state(struct device *dev, struct lcd_state *state){
+  dev_getState(dev_get_drvdata(dev), state);
+}
+
 static ssize_t show_on_off(bool isOn, char *buf){
   if(isOn){
     strcpy(buf, "on\n");
@@ -189,16 +457,25 @@ static ssize_t show_on_off(bool isOn, char *buf){
   return strlen(buf) + 1;
 }
 
-static ssize_t exec_on_off(void (*exec_on)(void), void (*exec_off)(void), const char *buf, size_t count){
+static ssize_t exec_on_off(struct device *dev, void (*exec_on)(struct lcd *), void (*exec_off)(struct lcd *), const char *buf, size_t count){
+  struct lcd_dev *lcddev = dev_get_drvdata(dev);
+  ssize_t ret = count;
+
+  // the same lock as the flush worker, commands must not split a transfer
+  mutex_lock(&lcddev->bus_lock);
   if(!strncmp(buf, "on", 2)) {
-    exec_on();
-    return 3;
+    exec_on(&lcddev->lcd);
+    ret = 3;
   }
   else if(!strncmp(buf, "off", 3)){
-    exec_off();
-    return 4;
+    exec_off(&lcddev->lcd);
+    ret = 4;
   }
-  return count;
+  spin_lock(&lcddev->frame_lock);
+  dev_publish(lcddev);
+  spin_unlock(&lcddev->frame_lock);
+  mutex_unlock(&lcddev->bus_lock);
+  return ret;
 }
 
 static ssize_t show_right_left(bool isRight, char *buf){ 
@@ -211,14 +488,47 @@ static ssize_t show_right_left(bool isRight, char *buf){
   return strlen(buf) + 1;
 }
 
-static ssize_t exec_right_left(void (*exec_right)(void), void (*exec_left)(void), const char *buf, size_t count){
+static ssize_t exec_right_left(struct device *dev, void (*exec_right)(struct lcd *), void (*exec_left)(struct lcd *), const char *buf, size_t count){
+  struct lcd_dev *lcddev = dev_get_drvdata(dev);
+  ssize_t ret = count;
+
+  mutex_lock(&lcddev->bus_lock);
   if(!strncmp(buf, "right", 2)) {
-    exec_right();
-    return 6;
+    exec_right(&lcddev->lcd);
+    ret = 6;
   }
   else if(!strncmp(buf, "left", 3)){
-    exec_left();
-    return 5;
+    exec_left(&lcddev->lcd);
+    ret = 5;
   }
-  return count;
+  spin_lock(&lcddev->frame_lock);
+  dev_publish(lcddev);
+  spin_unlock(&lcddev->frame_lock);
+  mutex_unlock(&lcddev->bus_lock);
+  return ret;
+}
+
+// copy a write into a terminated buffer on the stack
+static int copy_arg(const char *buf, size_t count, char *str, size_t size){
+  if(count >= size) return -EINVAL;
+  memcpy(str, buf, count);
+  str[count] = '\0';
+  return 0;
+}
+
+// "<col>:<row>", the numbers may also be separated by " ;,."
+static int parse_position(char *str, u8 *col, u8 *row){
+  static const char DELIMITERS[] = " \n\r:;,.";
+  char *tok = str;
+
+  if(kstrtou8(strsep(&tok, DELIMITERS), 10, col) || tok == NULL) return -EINVAL;
+  return kstrtou8(strsep(&tok, DELIMITERS), 10, row) ? -EINVAL : 0;
+}
+
+// set or clear flag in flags by the words for on and off
+static int parse_flag(const char *str, const char *on, const char *off, unsigned char flag, unsigned char *flags){
+  if(!strcmp(str, on)) *flags |= flag;
+  else if(!strcmp(str, off)) *flags &= ~flag;
+  else return -EINVAL;
+  return 0;
 }
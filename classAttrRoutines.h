@@ -6,7 +6,6 @@
 #include <linux/device.h>
 #include <linux/kernel.h>
 #include <linux/string.h>
-#include <linux/slab.h>   // for kmalloc
 
 int  lcdClassAttr_init(struct class *cls);
 void lcdClassAttr_destroy(void);
@@ -0,0 +1,128 @@
+#include "debugRoutines.h"
+#include "devroutines.h"
+
+static struct dentry *lcdDebugRoot = NULL;   // /sys/kernel/debug/lcdchar
+
+static int commands_show(struct seq_file *s, void *unused);
+static int latency_show(struct seq_file *s, atomic_long_t *hist);
+static int write_latency_show(struct seq_file *s, void *unused);
+static int flush_latency_show(struct seq_file *s, void *unused);
+static int commands_open(struct inode *inode, struct file *file);
+static int write_latency_open(struct inode *inode, struct file *file);
+static int flush_latency_open(struct inode *inode, struct file *file);
+static int dropped_get(void *data, u64 *val);
+
+static const struct file_operations commands_fops = {
+  .open = commands_open,
+  .read = seq_read,
+  .llseek = seq_lseek,
+  .release = single_release,
+};
+static const struct file_operations write_latency_fops = {
+  .open = write_latency_open,
+  .read = seq_read,
+  .llseek = seq_lseek,
+  .release = single_release,
+};
+static const struct file_operations flush_latency_fops = {
+  .open = flush_latency_open,
+  .read = seq_read,
+  .llseek = seq_lseek,
+  .release = single_release,
+};
+DEFINE_SIMPLE_ATTRIBUTE(dropped_fops, dropped_get, NULL, "%llu\n");
+
+/** 
+ *  Create the debugfs directory of the module
+ *  The driver works without debugfs, so failures are not reported.
+ */
+int lcdDebug_init(void){
+  lcdDebugRoot = debugfs_create_dir(CLASS_NAME, NULL);
+  return 0;
+}
+
+/** 
+ *  Counters and latency histograms of one display in /sys/kernel/debug/lcdchar/<name>/
+ *  The values are read without locking, a read may mix two updates.
+ */
+void lcdDebug_add(struct lcd_dev *dev, const char *name){
+  struct dentry *dir;
+
+  dir = debugfs_create_dir(name, lcdDebugRoot);
+  dev->debugfs = dir;
+
+  debugfs_create_ulong("bytes",      S_IRUGO, dir, &dev->lcd.stats.bytes);
+  debugfs_create_ulong("data",       S_IRUGO, dir, &dev->lcd.stats.data);
+  debugfs_create_ulong("gpio_calls", S_IRUGO, dir, &dev->lcd.stats.gpio_calls);
+  debugfs_create_ulong("bus_bytes",  S_IRUGO, dir, &dev->lcd.stats.bus_bytes);
+  debugfs_create_ulong("transfers",  S_IRUGO, dir, &dev->lcd.stats.transfers);
+  debugfs_create_ulong("pulses",     S_IRUGO, dir, &dev->lcd.stats.pulses);
+  debugfs_create_ulong("slept_us",   S_IRUGO, dir, &dev->lcd.stats.slept_us);
+  debugfs_create_ulong("spun_us",    S_IRUGO, dir, &dev->lcd.stats.spun_us);
+  debugfs_create_ulong("resyncs",    S_IRUGO, dir, &dev->lcd.stats.resyncs);
+  debugfs_create_ulong("repairs",    S_IRUGO, dir, &dev->lcd.stats.repairs);
+  debugfs_create_ulong("flushes",    S_IRUGO, dir, &dev->perf.flushes);
+  debugfs_create_file("dropped",       S_IRUGO, dir, dev, &dropped_fops);
+  debugfs_create_file("commands",      S_IRUGO, dir, dev, &commands_fops);
+  debugfs_create_file("write_latency", S_IRUGO, dir, dev, &write_latency_fops);
+  debugfs_create_file("flush_latency", S_IRUGO, dir, dev, &flush_latency_fops);
+}
+
+void lcdDebug_remove(struct lcd_dev *dev){
+  debugfs_remove_recursive(dev->debugfs);
+  dev->debugfs = NULL;
+}
+
+void lcdDebug_destroy(void){
+  debugfs_remove_recursive(lcdDebugRoot);
+  lcdDebugRoot = NULL;
+}
+
+// one line per instruction class: <name> <count>
+static int commands_show(struct seq_file *s, void *unused){
+  struct lcd_dev *dev = s->private;
+  unsigned int i;
+
+  for(i = 0; i < LCD_CMD_CLASSES; i++){
+    seq_printf(s, "%-16s %lu\n", lcd_getCommandName(i), READ_ONCE(dev->lcd.stats.commands[i]));
+  }
+  return 0;
+}
+
+// one line per non empty bucket: <from ns> <to ns> <count>
+static int latency_show(struct seq_file *s, atomic_long_t *hist){
+  unsigned int i;
+  long n;
+
+  for(i = 0; i < DEV_HIST_BUCKETS; i++){
+    n = atomic_long_read(&hist[i]);
+    if(n == 0) continue;
+    seq_printf(s, "%12llu %12llu %lu\n", i ? 1ULL << (i - 1) : 0ULL, (1ULL << i) - 1, n);
+  }
+  return 0;
+}
+static int write_latency_show(struct seq_file *s, void *unused){
+  struct lcd_dev *dev = s->private;
+  return latency_show(s, dev->perf.write_ns);
+}
+static int flush_latency_show(struct seq_file *s, void *unused){
+  struct lcd_dev *dev = s->private;
+  return latency_show(s, dev->perf.flush_ns);
+}
+
+static int commands_open(struct inode *inode, struct file *file){
+  return single_open(file, commands_show, inode->i_private);
+}
+static int write_latency_open(struct inode *inode, struct file *file){
+  return single_open(file, write_latency_show, inode->i_private);
+}
+static int flush_latency_open(struct inode *inode, struct file *file){
+  return single_open(file, flush_latency_show, inode->i_private);
+}
+
+// rendered frames that were replaced before they reached the display
+static int dropped_get(void *data, u64 *val){
+  struct lcd_dev *dev = data;
+  *val = atomic_long_read(&dev->perf.dropped);
+  return 0;
+}
@@ -0,0 +1,14 @@
+#ifndef _DEBUGROUTINES_H
+#define _DEBUGROUTINES_H
+
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+struct lcd_dev;
+
+int  lcdDebug_init(void);
+void lcdDebug_add(struct lcd_dev *dev, const char *name);
+void lcdDebug_remove(struct lcd_dev *dev);
+void lcdDebug_destroy(void);
+
+#endif
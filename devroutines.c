@@ -1,34 +1,55 @@
 
 #include "devroutines.h"
+#include "debugRoutines.h"
 
-#define DEV_BUFFERLENGTH 165    // max displaysize = 40columns * 4rows + 4*'\n' + 1*'\0'
-#define DEV_ROWLENGTH     41    // lenght of a displayed row-string (40columns + 1*'\n')
+#define DEV_MAXFPS         25    // default limit of flushes per second, 0 for no limit
+#define DEV_MARQUEE_SPEED   4    // default marquee steps per second
 
 
+/**
+ *  One open file, reads from offset 0 take a snapshot of the frame that is
+ *  handed out until the next read from offset 0
+ */
+struct lcd_file {
+  struct lcd_dev *dev;
+  struct mutex lock;                     // Protects the snapshot
+  struct lcd_state state;                // snapshot with the user representation of the frame
+};
+
 static int    majorNumber;                               // Stores the device number -- determined automatically
-static char   message_passed[DEV_BUFFERLENGTH] = {0};    // Memory for the string that is passed from userspace
-static char   display_content[DEV_BUFFERLENGTH] = {0};   // Memory for the user representation
-//static size_t size_of_message_passed;                    // Used to remember the size of the string stored
-static int    numberOpens = 0;                           // Counts the number of times the device is opened
 static struct class*  lcdClass  = NULL;                  // The device-driver class struct pointer
-static struct device* lcdDevice = NULL;                  // The device-driver device struct pointer
-
-// Macro to declare a new mutex
-static DEFINE_MUTEX(lcd_mutex);
+static struct lcd_dev* lcdDevices[LCD_MAX_PANELS];       // The displays, indexed by minor number
 
 // The prototype functions for the character driver
 static int     dev_open(struct inode *, struct file *);
 static int     dev_release(struct inode *, struct file *);
 static ssize_t dev_read(struct file *, char *, size_t, loff_t *);
 static ssize_t dev_write(struct file *, const char *, size_t, loff_t *);
+static unsigned int dev_poll(struct file *, poll_table *);
+static long    dev_ioctl(struct file *, unsigned int, unsigned long);
+static int     dev_mmap(struct file *, struct vm_area_struct *);
+static void    dev_flush(struct work_struct *);
+static void    dev_marquee(struct work_struct *);
+static void    dev_scrub(struct work_struct *);
+static long    dev_batch(struct lcd_dev *, const struct lcd_batch __user *);
+static int     dev_checkOp(struct lcd_dev *, const struct lcd_op *);
+static void    dev_histAdd(atomic_long_t *, u64);
+static void    dev_flushNow(struct lcd_dev *);
+static void    dev_runOp(struct lcd_dev *, const struct lcd_op *);
 
  
 // Device is represented as file structure in the kernel
+// An open file or mapping holds the module, so dev_destroy() never frees a lcd_dev that is still in use
 static struct file_operations fops =
   {
+    .owner = THIS_MODULE,
     .open = dev_open,
     .read = dev_read,
     .write = dev_write,
+    .poll = dev_poll,
+    .llseek = default_llseek,
+    .unlocked_ioctl = dev_ioctl,
+    .mmap = dev_mmap,
     .release = dev_release,
   };
 
@@ -37,6 +58,8 @@ static struct file_operations fops =
  */ 
 int dev_init(){
   int ret = 0;
+
+  BUILD_BUG_ON(LCD_GLYPH_COUNT > LCD_USER_GLYPHS);
   
   // Try to dynamically allocate a major number for the device
   majorNumber = register_chrdev(0, DEVICE_NAME, &fops);
@@ -54,21 +77,13 @@ int dev_init(){
     goto dev_init_exit2;
   }
   printk(KERN_INFO "Lcd: device class registered correctly\n");
-  
-  // Register the device driver
-  lcdDevice = device_create(lcdClass, NULL, MKDEV(majorNumber, 0), NULL, DEVICE_NAME);
-  if (IS_ERR(lcdDevice)){
-    printk(KERN_ALERT "Lcd: Failed to create the device\n");
-    ret =  PTR_ERR(lcdDevice);
-    goto dev_init_exit1;
-  }
-  printk(KERN_INFO "Lcd: device class created correctly\n"); 
 
-  // add class attributes
+  // add the attributes every device of the class gets
   ret = lcdClassAttr_init(lcdClass);
   if(ret) goto dev_init_exit1;
+
+  lcdDebug_init();
   
-  mutex_init(&lcd_mutex);
   return ret;
 
  dev_init_exit1:
@@ -81,12 +96,96 @@ int dev_init(){
 }
 
 /** 
- *  Function to cleanup the module's device class
+ *  Initialize a display and create its device
+ *  @return the new device or an ERR_PTR()
+ */
+struct lcd_dev *dev_add(unsigned int minor, const struct lcd_config *config){
+  struct lcd_dev *dev;
+  int ret;
+
+  if(minor >= LCD_MAX_PANELS || lcdDevices[minor]){
+    return ERR_PTR(-EINVAL);
+  }
+
+  dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+  if(dev == NULL){
+    return ERR_PTR(-ENOMEM);
+  }
+  dev->minor = minor;
+  dev->max_fps = DEV_MAXFPS;
+  dev->marquee_speed = DEV_MARQUEE_SPEED;
+  spin_lock_init(&dev->frame_lock);
+  mutex_init(&dev->bus_lock);
+  mutex_init(&dev->write_lock);
+  init_waitqueue_head(&dev->readers);
+  seqlock_init(&dev->state_lock);
+  INIT_DELAYED_WORK(&dev->flush_work, dev_flush);
+  INIT_DELAYED_WORK(&dev->marquee_work, dev_marquee);
+  INIT_DELAYED_WORK(&dev->scrub_work, dev_scrub);
+
+  ret = lcd_init(&dev->lcd, config);
+  if(ret) goto dev_add_exit2;
+  spin_lock(&dev->frame_lock);
+  dev_publish(dev);
+  spin_unlock(&dev->frame_lock);
+
+  // Register the device driver, the first display keeps the name /dev/lcdchar
+  lcdDevices[minor] = dev;
+  if(minor == 0){
+    dev->device = device_create(lcdClass, NULL, MKDEV(majorNumber, minor), dev, DEVICE_NAME);
+  }
+  else{
+    dev->device = device_create(lcdClass, NULL, MKDEV(majorNumber, minor), dev, DEVICE_NAME "%u", minor);
+  }
+  if (IS_ERR(dev->device)){
+    printk(KERN_ALERT "Lcd: Failed to create the device\n");
+    ret = PTR_ERR(dev->device);
+    goto dev_add_exit1;
+  }
+  printk(KERN_INFO "Lcd: device %u created correctly\n", minor);
+  lcdDebug_add(dev, dev_name(dev->device));
+
+  return dev;
+
+ dev_add_exit1:
+  lcdDevices[minor] = NULL;
+  lcd_uninit(&dev->lcd);
+
+ dev_add_exit2:
+  kfree(dev);
+
+  return ERR_PTR(ret);
+}
+
+/** 
+ *  Function to cleanup the module's devices and device class
  */
 int dev_destroy(){
-  mutex_destroy(&lcd_mutex);
+  struct lcd_dev *dev;
+  unsigned int minor;
+
+  for(minor = 0; minor < LCD_MAX_PANELS; minor++){
+    dev = lcdDevices[minor];
+    if(dev == NULL){
+      continue;
+    }
+    // remove the device first, so no flush is pending when the pins are released
+    // the marquee queues flushes, it is stopped before the flush work is cancelled
+    lcdDebug_remove(dev);
+    device_destroy(lcdClass, MKDEV(majorNumber, minor));
+    WRITE_ONCE(dev->scrub_interval, 0);
+    cancel_delayed_work_sync(&dev->scrub_work);
+    cancel_delayed_work_sync(&dev->marquee_work);
+    cancel_delayed_work_sync(&dev->flush_work);
+    lcd_uninit(&dev->lcd);
+    mutex_destroy(&dev->bus_lock);
+    mutex_destroy(&dev->write_lock);
+    lcdDevices[minor] = NULL;
+    kfree(dev);
+  }
+
+  lcdDebug_destroy();
   lcdClassAttr_destroy();
-  device_destroy(lcdClass, MKDEV(majorNumber, 0));
   class_unregister(lcdClass);
   class_destroy(lcdClass);
   unregister_chrdev(majorNumber, DEVICE_NAME);
@@ -97,11 +196,23 @@ int dev_destroy(){
  *  The device open function that is called each time the device is opened
  */
 static int dev_open(struct inode *inodep, struct file *filep){
-  if(!mutex_trylock(&lcd_mutex)){
-    printk(KERN_ALERT "Lcd: Device in use by another process");
-    return -EBUSY;
+  struct lcd_dev *dev;
+  struct lcd_file *file;
+
+  if(iminor(inodep) >= LCD_MAX_PANELS || (dev = lcdDevices[iminor(inodep)]) == NULL){
+    return -ENODEV;
   }
-  numberOpens++;
+  file = kzalloc(sizeof(*file), GFP_KERNEL);
+  if(file == NULL){
+    return -ENOMEM;
+  }
+  file->dev = dev;
+  mutex_init(&file->lock);
+  // a new reader has not seen any frame yet
+  file->state.generation = READ_ONCE(dev->generation) - 1;
+
+  // any number of writers, every frame they render is flushed under the bus lock
+  filep->private_data = file;
   
   return 0;
 }
@@ -110,60 +221,444 @@ static int dev_open(struct inode *inodep, struct file *filep){
  *  This function is called whenever device is being read from user space
  */
 static ssize_t dev_read(struct file *filep, char *buffer, size_t to_copy, loff_t *offset){
+  struct lcd_file *file = filep->private_data;
+  struct lcd_dev *dev = file->dev;
   unsigned long not_copied;
+  ssize_t ret;
 
-  to_copy = (size_t)(DEV_BUFFERLENGTH - 1) - *offset;//min(to_copy, (size_t)(DEV_BUFFERLENGTH - 1));
+  if(*offset < 0){
+    return -EINVAL;
+  }
+
+  mutex_lock(&file->lock);
+  // a read from the start takes a new snapshot, the following ones continue it
+  if(*offset == 0){
+    dev_getState(dev, &file->state);
+  }
+  if(*offset >= file->state.len){
+    ret = 0;
+    goto dev_read_exit;
+  }
+  to_copy = min(to_copy, (size_t)(file->state.len - *offset));
 
   // copy displaystate to user
-  if((not_copied = copy_to_user(buffer, display_content, to_copy))){
+  if((not_copied = copy_to_user(buffer, file->state.frame + *offset, to_copy))){
     printk(KERN_INFO "Lcd: Failed to send %lu characters\n", not_copied);
+    if(not_copied == to_copy){
+      ret = -EFAULT;
+      goto dev_read_exit;
+    }
   }
   
   *offset += to_copy - not_copied;
+  ret = to_copy - not_copied;
 
-  return to_copy - not_copied;
+ dev_read_exit:
+  mutex_unlock(&file->lock);
+  return ret;
+}
+
+/** 
+ *  Readable once a changed frame was flushed since the last snapshot of this file
+ */
+static unsigned int dev_poll(struct file *filep, poll_table *wait){
+  struct lcd_file *file = filep->private_data;
+  struct lcd_dev *dev = file->dev;
+
+  poll_wait(filep, &dev->readers, wait);
+  if(READ_ONCE(dev->generation) != READ_ONCE(file->state.generation)){
+    return POLLIN | POLLRDNORM;
+  }
+  return 0;
 }
 
 /** 
  *  This function is called whenever the character device is being written to from user space 
  */
 static ssize_t dev_write(struct file *filep, const char *buffer, size_t len, loff_t *offset){
-  int error_count, i;
-  unsigned char cursorpos;
+  struct lcd_dev *dev = ((struct lcd_file *)filep->private_data)->dev;
+  char message_passed[DEV_BUFFERLENGTH];              // Memory for the string that is passed from userspace
+  u64 start = ktime_get_ns();
+  int error_count;
 
-  cursorpos = lcd_getCursorPosRow() * DEV_ROWLENGTH + lcd_getCursorPosCol();
   len = min(len, (size_t)(DEV_BUFFERLENGTH - 1));
   
   error_count = copy_from_user(message_passed, buffer, len);
 
+  // the buffer is not initialized, only what was copied may be rendered
   if(error_count){
-    printk(KERN_ALERT "Lcd: Could not receive %d characters", error_count);
+    printk(KERN_ALERT "Lcd: Could not receive %d characters\n", error_count);
+    return -EFAULT;
   }
 
-  lcd_printn(message_passed, len);                    // display message on lcd
+  // a running batch keeps its cursor until it is done
+  mutex_lock(&dev->write_lock);
+  spin_lock(&dev->frame_lock);
+  lcd_render(&dev->lcd, message_passed, len);    // the worker sends the changed cells
+  spin_unlock(&dev->frame_lock);
+  mutex_unlock(&dev->write_lock);
+
+  dev_scheduleFlush(dev);
   
-  //  size_of_message_passed = strlen(message_passed);                 // store the length of the stored message
-  printk(KERN_INFO "Lcd: Received %zu characters from the user\n", len);
+  dev_dbg(dev->device, "Received %zu characters from the user\n", len);
+  dev_histAdd(dev->perf.write_ns, ktime_get_ns() - start);
+
+  return len;
+}
+
+/** 
+ *  Control requests, see lcdioctl.h
+ */
+static long dev_ioctl(struct file *filep, unsigned int cmd, unsigned long arg){
+  struct lcd_dev *dev = ((struct lcd_file *)filep->private_data)->dev;
+  struct lcd_geometry geometry;
+  __u64 generation;
 
-  for(i=0; i<=len; i++) {
-    if( !(cursorpos % (DEV_ROWLENGTH - 1)) ){         // end of line: jump to next line 
-      cursorpos++;
+  switch(cmd){
+  case LCD_IOC_GEOMETRY:
+    geometry.rows = lcd_getRows(&dev->lcd);
+    geometry.cols = lcd_getCols(&dev->lcd);
+    if(copy_to_user((void __user *)arg, &geometry, sizeof(geometry))){
+      return -EFAULT;
     }
-    if( cursorpos >= DEV_BUFFERLENGTH ){              // end of buffer: continue from zero
-      cursorpos = 0;
+    return 0;
+  case LCD_IOC_COMMIT:
+    dev_scheduleFlush(dev);
+    return 0;
+  case LCD_IOC_BATCH:
+    return dev_batch(dev, (const struct lcd_batch __user *)arg);
+  case LCD_IOC_GENERATION:
+    generation = READ_ONCE(dev->generation);
+    if(copy_to_user((void __user *)arg, &generation, sizeof(generation))){
+      return -EFAULT;
     }
-    display_content[cursorpos++] = message_passed[i]; // write into diplaybuffer
+    return 0;
+  default:
+    return -ENOTTY;
   }
+}
+
+/** 
+ *  Run a batch of operations, all or none
+ *  The bus lock is held from the first operation until the frame is flushed,
+ *  the write lock until the last operation, so no other writer moves the cursor in between.
+ */
+static long dev_batch(struct lcd_dev *dev, const struct lcd_batch __user *ubatch){
+  struct lcd_batch batch;
+  struct lcd_op *ops;
+  long ret = 0;
+  u32 i;
 
-  for(i=0; i<=3; i++){                                // set linebreaks at 40, 81, 122, 163
-    display_content[DEV_ROWLENGTH * i + (DEV_ROWLENGTH - 1)] = '\n';
+  if(copy_from_user(&batch, ubatch, sizeof(batch))){
+    return -EFAULT;
+  }
+  if(batch.count == 0){
+    return 0;
+  }
+  if(batch.count > LCD_BATCH_MAX){
+    return -EINVAL;
   }
 
-  display_content[DEV_BUFFERLENGTH - 1] = '\0';       // set end of buffer
-  
+  ops = kmalloc_array(batch.count, sizeof(*ops), GFP_KERNEL);
+  if(ops == NULL){
+    return -ENOMEM;
+  }
+  if(copy_from_user(ops, u64_to_user_ptr(batch.ops), batch.count * sizeof(*ops))){
+    ret = -EFAULT;
+    goto dev_batch_exit;
+  }
+  for(i = 0; i < batch.count; i++){
+    ret = dev_checkOp(dev, &ops[i]);
+    if(ret) goto dev_batch_exit;
+  }
 
-  
-  return len;
+  mutex_lock(&dev->bus_lock);
+  mutex_lock(&dev->write_lock);
+  for(i = 0; i < batch.count; i++){
+    dev_runOp(dev, &ops[i]);
+  }
+  mutex_unlock(&dev->write_lock);
+
+  // flush right away, the caller sees the result when the ioctl returns
+  dev_flushNow(dev);
+  mutex_unlock(&dev->bus_lock);
+
+ dev_batch_exit:
+  kfree(ops);
+  return ret;
+}
+
+/** 
+ *  Validate one operation of a batch
+ */
+static int dev_checkOp(struct lcd_dev *dev, const struct lcd_op *op){
+  switch(op->code){
+  case LCD_OP_CURSOR:
+    if(op->col >= lcd_getCols(&dev->lcd) || op->row >= lcd_getRows(&dev->lcd)) return -EINVAL;
+    return 0;
+  case LCD_OP_WRITE:
+    return (op->len > LCD_OP_DATA) ? -EINVAL : 0;
+  case LCD_OP_CHAR:
+    return (op->arg > 7) ? -EINVAL : 0;
+  case LCD_OP_CONTROL:
+    return (op->arg & ~(LCD_CTRL_DISPLAY | LCD_CTRL_CURSOR | LCD_CTRL_BLINK)) ? -EINVAL : 0;
+  case LCD_OP_ENTRY:
+    return (op->arg & ~(LCD_ENTRY_INCREMENT | LCD_ENTRY_SHIFT)) ? -EINVAL : 0;
+  case LCD_OP_SHIFT:
+    return (op->arg & ~(LCD_SHIFT_DISPLAY | LCD_SHIFT_RIGHT)) ? -EINVAL : 0;
+  case LCD_OP_GLYPH:
+  case LCD_OP_ICON:
+    return (op->arg >= LCD_GLYPH_COUNT) ? -EINVAL : 0;
+  default:
+    return -EINVAL;
+  }
+}
+
+/** 
+ *  Execute one checked operation, called with the bus lock held
+ *  Cursor moves and text go into the frame, the rest is sent to the display.
+ */
+static void dev_runOp(struct lcd_dev *dev, const struct lcd_op *op){
+  unsigned char charmap[8];
+
+  switch(op->code){
+  case LCD_OP_CURSOR:
+    spin_lock(&dev->frame_lock);
+    lcd_moveCursor(&dev->lcd, op->col, op->row);
+    spin_unlock(&dev->frame_lock);
+    break;
+  case LCD_OP_WRITE:
+    spin_lock(&dev->frame_lock);
+    lcd_renderRaw(&dev->lcd, op->data, op->len);
+    spin_unlock(&dev->frame_lock);
+    break;
+  case LCD_OP_CHAR:
+    memcpy(charmap, op->data, sizeof(charmap));
+    lcd_createChar(&dev->lcd, op->arg, charmap);
+    break;
+  case LCD_OP_CONTROL:
+    lcd_setControl(&dev->lcd, op->arg);
+    break;
+  case LCD_OP_ENTRY:
+    lcd_setEntryMode(&dev->lcd, op->arg);
+    break;
+  case LCD_OP_SHIFT:
+    lcd_shift(&dev->lcd, op->arg);
+    break;
+  case LCD_OP_GLYPH:
+    spin_lock(&dev->frame_lock);
+    lcd_registerGlyph(&dev->lcd, op->arg, op->data, op->data[8]);
+    spin_unlock(&dev->frame_lock);
+    break;
+  case LCD_OP_ICON:
+    spin_lock(&dev->frame_lock);
+    lcd_renderGlyph(&dev->lcd, op->arg);
+    spin_unlock(&dev->frame_lock);
+    break;
+  }
+}
+
+/** 
+ *  Map the page of the rendered frame, changes are shown after LCD_IOC_COMMIT
+ */
+static int dev_mmap(struct file *filep, struct vm_area_struct *vma){
+  struct lcd_dev *dev = ((struct lcd_file *)filep->private_data)->dev;
+
+  if(vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > PAGE_SIZE){
+    return -EINVAL;
+  }
+  // a private mapping would copy the page on the first store, LCD_IOC_COMMIT would not see it
+  if(!(vma->vm_flags & VM_SHARED)){
+    return -EINVAL;
+  }
+  return vm_insert_page(vma, vma->vm_start, virt_to_page(lcd_getFrameBuffer(&dev->lcd)));
+}
+
+/** 
+ *  Schedule the flush of the rendered frame
+ *  The frame rate limit is respected, a frame still waiting for its flush is replaced.
+ */
+void dev_scheduleFlush(struct lcd_dev *dev){
+  unsigned long delay = 0;
+  unsigned int fps = READ_ONCE(dev->max_fps);
+
+  if(fps && time_before(jiffies, dev->last_flush + HZ / fps)){
+    delay = dev->last_flush + HZ / fps - jiffies;
+  }
+  if(!schedule_delayed_work(&dev->flush_work, delay)){
+    atomic_long_inc(&dev->perf.dropped);    // the waiting frame is replaced by this one
+  }
+}
+
+/** 
+ *  Start, replace or stop (n = 0) the marquee, see lcd_setMarquee()
+ */
+int dev_setMarquee(struct lcd_dev *dev, unsigned char row, const char *text, size_t n){
+  int ret;
+
+  spin_lock(&dev->frame_lock);
+  ret = lcd_setMarquee(&dev->lcd, row, text, n);
+  spin_unlock(&dev->frame_lock);
+  if(ret){
+    return ret;
+  }
+
+  // the first flush loads the text, then the worker steps it
+  dev_scheduleFlush(dev);
+  if(n){
+    mod_delayed_work(system_wq, &dev->marquee_work, HZ / READ_ONCE(dev->marquee_speed));
+  }
+  return 0;
+}
+
+/** 
+ *  Work function: move the marquee by one column, a flush sends one shift instruction
+ */
+static void dev_marquee(struct work_struct *work){
+  struct lcd_dev *dev = container_of(to_delayed_work(work), struct lcd_dev, marquee_work);
+  bool active;
+
+  spin_lock(&dev->frame_lock);
+  active = lcd_stepMarquee(&dev->lcd);
+  spin_unlock(&dev->frame_lock);
+  if(!active){
+    return;
+  }
+  dev_scheduleFlush(dev);
+  schedule_delayed_work(&dev->marquee_work, HZ / READ_ONCE(dev->marquee_speed));
+}
+
+/** 
+ *  Read the display back and rewrite the cells that differ, see lcd_resync()
+ *  @return number of differences, or -EOPNOTSUPP if the display cannot be read
+ */
+int dev_resync(struct lcd_dev *dev){
+  int ret;
+
+  mutex_lock(&dev->bus_lock);
+  ret = lcd_resync(&dev->lcd);
+  mutex_unlock(&dev->bus_lock);
+  if(ret > 0){
+    printk_ratelimited(KERN_WARNING "Lcd: device %u: %d differences to the display repaired\n", dev->minor, ret);
+  }
+  return ret;
+}
+
+/** 
+ *  Read the display back every seconds, 0 stops it
+ *  The first read back is done right away, it fails if the display cannot be read.
+ */
+int dev_setScrub(struct lcd_dev *dev, unsigned int seconds){
+  int ret;
+
+  WRITE_ONCE(dev->scrub_interval, seconds);
+  if(seconds == 0){
+    cancel_delayed_work_sync(&dev->scrub_work);
+    return 0;
+  }
+  ret = dev_resync(dev);
+  if(ret < 0){
+    WRITE_ONCE(dev->scrub_interval, 0);
+    return ret;
+  }
+  mod_delayed_work(system_wq, &dev->scrub_work, seconds * HZ);
+  return 0;
+}
+
+/** 
+ *  Work function: read the display back, the interval is rechecked so a stop is never missed
+ */
+static void dev_scrub(struct work_struct *work){
+  struct lcd_dev *dev = container_of(to_delayed_work(work), struct lcd_dev, scrub_work);
+  unsigned int seconds;
+
+  if(READ_ONCE(dev->scrub_interval) == 0){
+    return;
+  }
+  if(dev_resync(dev) < 0){
+    printk(KERN_WARNING "Lcd: device %u cannot be read back, scrubbing stopped\n", dev->minor);
+    WRITE_ONCE(dev->scrub_interval, 0);
+    return;
+  }
+  seconds = READ_ONCE(dev->scrub_interval);
+  if(seconds){
+    schedule_delayed_work(&dev->scrub_work, seconds * HZ);
+  }
+}
+
+/** 
+ *  Work function: commit the latest rendered frame and send it to the display
+ */
+static void dev_flush(struct work_struct *work){
+  struct lcd_dev *dev = container_of(to_delayed_work(work), struct lcd_dev, flush_work);
+
+  mutex_lock(&dev->bus_lock);
+  dev_flushNow(dev);
+  mutex_unlock(&dev->bus_lock);
+}
+
+/** 
+ *  Commit the rendered frame and send it, called with the bus lock held
+ */
+static void dev_flushNow(struct lcd_dev *dev){
+  u64 start = ktime_get_ns();
+  bool changed;
+
+  spin_lock(&dev->frame_lock);
+  changed = lcd_commit(&dev->lcd);
+  spin_unlock(&dev->frame_lock);
+
+  lcd_flush(&dev->lcd);
+
+  // readers only get to see the frame once it is on the display
+  spin_lock(&dev->frame_lock);
+  if(changed){
+    WRITE_ONCE(dev->generation, dev->generation + 1);
+  }
+  dev_publish(dev);
+  spin_unlock(&dev->frame_lock);
+  if(changed){
+    wake_up_interruptible(&dev->readers);
+  }
+  dev->last_flush = jiffies;
+  dev->perf.flushes++;
+  dev_histAdd(dev->perf.flush_ns, ktime_get_ns() - start);
+}
+
+/** 
+ *  Publish the display state for readers, called with the frame lock held
+ *  Every writer of the control or entry mode flags calls it afterwards.
+ */
+void dev_publish(struct lcd_dev *dev){
+  struct lcd *lcd = &dev->lcd;
+
+  write_seqlock(&dev->state_lock);
+  dev->state.control = lcd_getControl(lcd);
+  dev->state.mode = lcd_getEntryMode(lcd);
+  dev->state.col = lcd_getCursorPosCol(lcd);
+  dev->state.row = lcd_getCursorPosRow(lcd);
+  dev->state.generation = dev->generation;
+  dev->state.len = lcd_getFrame(lcd, dev->state.frame, sizeof(dev->state.frame));
+  write_sequnlock(&dev->state_lock);
+}
+
+/** 
+ *  Copy the published display state, never waits for a writer
+ */
+void dev_getState(struct lcd_dev *dev, struct lcd_state *state){
+  unsigned int seq;
+
+  do{
+    seq = read_seqbegin(&dev->state_lock);
+    *state = dev->state;
+  } while(read_seqretry(&dev->state_lock, seq));
+}
+
+/** 
+ *  Count a latency in its log2 bucket
+ */
+static void dev_histAdd(atomic_long_t *hist, u64 ns){
+  atomic_long_inc(&hist[min(fls64(ns), DEV_HIST_BUCKETS - 1)]);
 }
 
 /** 
@@ -171,7 +666,10 @@ static ssize_t dev_write(struct file *filep, const char *buffer, size_t len, lof
  *  the userspace program
  */
 static int dev_release(struct inode *inodep, struct file *filep){
-  mutex_unlock(&lcd_mutex);           // release the mutex (i.e., lock goes up)
-  printk(KERN_INFO "Lcd: Device successfully closed\n");
+  struct lcd_file *file = filep->private_data;
+
+  dev_dbg(file->dev->device, "Device successfully closed\n");
+  mutex_destroy(&file->lock);
+  kfree(file);
   return 0;
 }
@@ -2,19 +2,84 @@
 #define _DEVROUTINES_H
 
 #include "lcdroutines.h"
+#include "lcdioctl.h"
 #include "classAttrRoutines.h"
 
 #include <linux/mutex.h>          // Required for the mutex functional
+#include <linux/seqlock.h>        // Publishes the display state to readers
+#include <linux/spinlock.h>       // Protects the rendered frame
+#include <linux/workqueue.h>      // Frames are flushed by a worker
+#include <linux/jiffies.h>
 #include <asm/uaccess.h>          // Required for the copy to user functino
 #include <linux/device.h>         // Header to support the kernel Driver Model
 #include <linux/fs.h>             // Header for the Linux file system support
+#include <linux/mm.h>             // Maps the frame to userspace
+#include <linux/ktime.h>          // Latency histograms
+#include <linux/poll.h>           // Readers wait for changed frames
+#include <linux/wait.h>
 
 
 #define  DEVICE_NAME "lcdchar"    ///< The device will appear at /dev/ebbchar using this value
 #define  CLASS_NAME  "lcdchar"    ///< The device class -- this is a character device driver
 
+#define  LCD_MAX_PANELS      4    ///< Number of displays (minor numbers) the module can drive
+#define  DEV_BUFFERLENGTH  165    // max displaysize = 40columns * 4rows + 4*'\n' + 1*'\0'
+#define  DEV_HIST_BUCKETS   32    // log2 latency buckets, the last one collects everything above 1s
+
+/**
+ *  Display state as seen by readers, published after every change so sysfs and
+ *  read() never wait for the bus or see half of an update
+ */
+struct lcd_state {
+  unsigned char control;                  // LCD_DISPLAYON, LCD_CURSORON, LCD_BLINKON
+  unsigned char mode;                     // LCD_ENTRYLEFT, LCD_ENTRYSHIFTINCREMENT
+  unsigned char col;                      // cursor
+  unsigned char row;
+  unsigned long generation;               // of the frame, see lcd_dev.generation
+  size_t len;
+  char frame[DEV_BUFFERLENGTH];           // committed frame, see lcd_getFrame()
+};
+
+/**
+ *  One display with its character device, every display has its own locks and
+ *  flush worker so independent displays are driven in parallel.
+ */
+struct lcd_dev {
+  struct lcd lcd;                         // display state and bus
+  struct device *device;                  // /dev/lcdchar (minor 0) or /dev/lcdchar<minor>
+  unsigned int minor;
+  spinlock_t frame_lock;                  // Protects the rendered frame and the cursor
+  struct mutex bus_lock;                  // Serializes all bus transfers: flushes and sysfs commands
+  struct mutex write_lock;                // Held by writers that move the cursor, a batch holds it for all its operations
+  struct delayed_work flush_work;
+  unsigned long last_flush;               // jiffies of the last flush
+  unsigned int max_fps;                   // flushes per second, 0 for no limit
+  struct delayed_work marquee_work;       // steps the marquee, see lcd_setMarquee()
+  unsigned int marquee_speed;             // marquee steps per second, 1 to HZ
+  struct delayed_work scrub_work;         // reads the display back, see lcd_resync()
+  unsigned int scrub_interval;            // seconds between two read backs, 0: off
+  unsigned long generation;               // counts flushed frames that changed, under frame_lock
+  wait_queue_head_t readers;              // woken after a changed frame was flushed
+  seqlock_t state_lock;                   // Writers hold frame_lock too, readers never block
+  struct lcd_state state;
+
+  struct{
+    unsigned long flushes;                // frames sent to the display, under bus_lock
+    atomic_long_t dropped;                // frames replaced before their flush
+    atomic_long_t write_ns[DEV_HIST_BUCKETS];   // latency of dev_write(), bucket fls64(ns)
+    atomic_long_t flush_ns[DEV_HIST_BUCKETS];   // latency of a flush
+  } perf;
+  struct dentry *debugfs;                 // /sys/kernel/debug/lcdchar/<device>/
+};
 
 int dev_init(void);
+struct lcd_dev *dev_add(unsigned int minor, const struct lcd_config *config);
 int dev_destroy(void);
+void dev_scheduleFlush(struct lcd_dev *dev);
+int  dev_setMarquee(struct lcd_dev *dev, unsigned char row, const char *text, size_t n);
+int  dev_resync(struct lcd_dev *dev);
+int  dev_setScrub(struct lcd_dev *dev, unsigned int seconds);
+void dev_publish(struct lcd_dev *dev);
+void dev_getState(struct lcd_dev *dev, struct lcd_state *state);
 
 #endif
@@ -0,0 +1,289 @@
+
+#include "gpioRoutines.h"
+#include <linux/gpio.h>
+#include <linux/gpio/consumer.h>
+#include <linux/io.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+
+// translate a logic level of the display into the level of the gpio
+#define LCD_LEVEL(bit) (LCD_HIGH ? (bit) : !(bit))
+
+// AM335x gpio bank registers, used if all pins belong to one bank
+#define AM335X_GPIO_BANKSIZE     0x1000
+#define AM335X_GPIO_CLEARDATAOUT 0x190
+#define AM335X_GPIO_SETDATAOUT   0x194
+static const unsigned long am335x_gpio_base[] = {
+  0x44E07000, 0x4804C000, 0x481AC000, 0x481AE000
+};
+
+// state of the gpio backend, lcd->bus_data
+struct lcd_gpio {
+  struct gpio_desc *bus[9];  // data pins followed by RS, driven with one call
+  int level[9];
+  struct gpio_desc *rw_desc;
+  struct gpio_desc *enable_desc;
+
+  void __iomem *base;        // mapped gpio bank, NULL if the fast path is off
+  u32 bank_bus[9];           // bank bits of the data pins and RS
+  u32 bank_enable;
+};
+
+static int  lcdGpio_init(struct lcd *lcd);
+static void lcdGpio_uninit(struct lcd *lcd);
+static void lcdGpio_setLines(struct lcd *lcd, unsigned char value, bool rs);
+static void lcdGpio_pulse(struct lcd *lcd);
+static unsigned char lcdGpio_read(struct lcd *lcd, bool rs);
+static unsigned char lcdGpio_readNbits(struct lcd *lcd, int n);
+static void lcdGpio_setEnable(struct lcd *lcd, int level);
+
+const struct lcd_bus_ops lcd_gpio_ops = {
+  .name = "gpio",
+  .init = lcdGpio_init,
+  .uninit = lcdGpio_uninit,
+  .set_lines = lcdGpio_setLines,
+  .pulse = lcdGpio_pulse,
+  .delay = lcd_wait,
+  .read = lcdGpio_read,
+};
+
+/** 
+ *  @brief Request and export the gpios of the display
+ *  @return 0 on success, -ENOMEM
+ */
+static int lcdGpio_init(struct lcd *lcd){
+  struct lcd_gpio *gpio;
+  int i;
+
+  gpio = kzalloc(sizeof(*gpio), GFP_KERNEL);
+  if (gpio == NULL) {
+    return -ENOMEM;
+  }
+  lcd->bus_data = gpio;
+
+  // setup rs pin
+  gpio_request(lcd->pin.rs, "sysfs");
+  gpio_direction_output(lcd->pin.rs, LCD_LOW);
+  gpio_export(lcd->pin.rs, false);
+
+  // we can save 1 pin by not using RW. Indicate by passing 255 instead of pin#
+  if (lcd->pin.rw != 255) {
+    printk(KERN_INFO "Lcd: READ/WRITE pin (RW) is supposed to be driven by gpio%d\n", lcd->pin.rs);
+    gpio_request(lcd->pin.rw, "sysfs");
+    gpio_direction_output(lcd->pin.rw, LCD_LOW);
+    gpio_export(lcd->pin.rw, false);
+  }
+  else{
+    printk(KERN_INFO "Lcd: READ/WRITE pin (RW) is supposed do be connected to ground (GND)\n");
+  }
+
+  gpio_request(lcd->pin.enable, "sysfs");
+  gpio_direction_output(lcd->pin.enable, LCD_LOW);
+  gpio_export(lcd->pin.enable, false);
+
+  // echo all pin connections
+  printk(KERN_INFO "Lcd: pin.rs == %d\n", lcd->pin.rs);
+  printk(KERN_INFO "Lcd: pin.rw == %d\n", lcd->pin.rw);
+  printk(KERN_INFO "Lcd: pin.enable == %d\n", lcd->pin.enable);
+  
+  // do these once, instead of every time a character is drawn for speed reasons.
+  for (i=0; i<lcd->pin.nbus; i++) {
+    printk(KERN_INFO "Lcd: pin.data[%d] == %d\n", i, lcd->pin.data[i]);
+    gpio_request(lcd->pin.data[i], "sysfs");
+    gpio_direction_output(lcd->pin.data[i], LCD_LOW);
+    gpio_export(lcd->pin.data[i], false);
+    gpio->bus[i] = gpio_to_desc(lcd->pin.data[i]);
+  }
+  gpio->bus[lcd->pin.nbus] = gpio_to_desc(lcd->pin.rs);
+  gpio->enable_desc = gpio_to_desc(lcd->pin.enable);
+  if (lcd->pin.rw != 255) {
+    gpio->rw_desc = gpio_to_desc(lcd->pin.rw);
+  }
+
+  // pull both RS and R/W low to begin commands
+  gpio_set_value(lcd->pin.rs, LCD_LOW);
+  gpio_set_value(lcd->pin.enable, LCD_LOW);
+  if(lcd->pin.rw != 255){
+    gpio_set_value(lcd->pin.rw, LCD_LOW);
+  }  
+  return 0;
+}
+
+static void lcdGpio_uninit(struct lcd *lcd){
+  struct lcd_gpio *gpio = lcd->bus_data;
+  int i;
+
+  if (gpio->base) {
+    iounmap(gpio->base);
+    gpio->base = NULL;
+  }
+
+  // set all gpios to 0
+  gpio_set_value(lcd->pin.rs, 0);
+  gpio_set_value(lcd->pin.rw, 0);
+  gpio_set_value(lcd->pin.enable, 0);
+
+  // unexport all gpios
+  gpio_unexport(lcd->pin.rs);
+  gpio_unexport(lcd->pin.rw);
+  gpio_unexport(lcd->pin.enable);
+
+  // free all gpios
+  gpio_free(lcd->pin.rs);
+  gpio_free(lcd->pin.rw);
+  gpio_free(lcd->pin.enable);
+
+  // do the previous 3 steps for all datapins
+  for (i = 0; i<lcd->pin.nbus; i++) {
+    gpio_set_value(lcd->pin.data[i], 0);
+    gpio_unexport(lcd->pin.data[i]);
+    gpio_free(lcd->pin.data[i]);
+  }
+  
+  printk(KERN_INFO "Lcd: all lcd-pins unexported\n");
+
+  kfree(gpio);
+  lcd->bus_data = NULL;
+}
+
+/**
+ *  @brief Drive the pins through the AM335x gpio bank registers
+ *  Only possible if the data pins, RS and enable belong to the same bank.
+ *  @return true if the fast path is in use
+ */
+bool lcdGpio_setFastIO(struct lcd *lcd, bool on){
+  struct lcd_gpio *gpio = lcd->bus_data;
+  unsigned int bank = lcd->pin.rs / 32;
+  int i;
+
+  if (gpio->base) {
+    iounmap(gpio->base);
+    gpio->base = NULL;
+  }
+  if (!on) {
+    return false;
+  }
+
+  if (bank >= ARRAY_SIZE(am335x_gpio_base) || lcd->pin.enable / 32 != bank) {
+    goto lcd_sfio_exit;
+  }
+  for (i = 0; i < lcd->pin.nbus; i++) {
+    if (lcd->pin.data[i] / 32 != bank) {
+      goto lcd_sfio_exit;
+    }
+    gpio->bank_bus[i] = BIT(lcd->pin.data[i] % 32);
+  }
+  gpio->bank_bus[lcd->pin.nbus] = BIT(lcd->pin.rs % 32);
+  gpio->bank_enable = BIT(lcd->pin.enable % 32);
+
+  gpio->base = ioremap(am335x_gpio_base[bank], AM335X_GPIO_BANKSIZE);
+  if (gpio->base == NULL) {
+    goto lcd_sfio_exit;
+  }
+  printk(KERN_INFO "Lcd: driving gpio bank %u through its registers\n", bank);
+  return true;
+
+ lcd_sfio_exit:
+  printk(KERN_INFO "Lcd: pins are not in one gpio bank, fast io disabled\n");
+  return false;
+}
+
+// Drive all data pins and RS at once
+static void lcdGpio_setLines(struct lcd *lcd, unsigned char value, bool rs){
+  struct lcd_gpio *gpio = lcd->bus_data;
+  u32 set = 0, clear = 0;
+  int i;
+
+  if (gpio->base) {
+    for (i = 0; i < lcd->pin.nbus; i++) {
+      if (LCD_LEVEL((value >> i) & 0x01)) {
+	set |= gpio->bank_bus[i];
+      }
+      else {
+	clear |= gpio->bank_bus[i];
+      }
+    }
+    if (LCD_LEVEL(rs)) {
+      set |= gpio->bank_bus[lcd->pin.nbus];
+    }
+    else {
+      clear |= gpio->bank_bus[lcd->pin.nbus];
+    }
+    writel(set, gpio->base + AM335X_GPIO_SETDATAOUT);
+    writel(clear, gpio->base + AM335X_GPIO_CLEARDATAOUT);
+    lcd->stats.gpio_calls += 2;
+    return;
+  }
+
+  for (i = 0; i < lcd->pin.nbus; i++) {
+    gpio->level[i] = LCD_LEVEL((value >> i) & 0x01);
+  }
+  gpio->level[lcd->pin.nbus] = LCD_LEVEL(rs);
+  gpiod_set_array_value(lcd->pin.nbus + 1, gpio->bus, gpio->level);
+  lcd->stats.gpio_calls++;
+}
+
+static void lcdGpio_pulse(struct lcd *lcd){
+  lcd_wait(lcd, 1);  // address setup time
+  lcdGpio_setEnable(lcd, LCD_HIGH);
+  lcd_wait(lcd, lcd->timing.pulse);  // enable pulse must be > 450ns
+  lcdGpio_setEnable(lcd, LCD_LOW);
+}
+
+static void lcdGpio_setEnable(struct lcd *lcd, int level){
+  struct lcd_gpio *gpio = lcd->bus_data;
+
+  if (gpio->base) {
+    writel(gpio->bank_enable, gpio->base + (level ? AM335X_GPIO_SETDATAOUT : AM335X_GPIO_CLEARDATAOUT));
+  }
+  else {
+    gpiod_set_value(gpio->enable_desc, level);
+  }
+  lcd->stats.gpio_calls++;
+}
+
+// Read the busy flag and address counter (rs false) or data (rs true)
+static unsigned char lcdGpio_read(struct lcd *lcd, bool rs){
+  struct lcd_gpio *gpio = lcd->bus_data;
+  unsigned char value;
+  int i, n = lcd->pin.nbus;
+
+  // release the bus before the controller starts driving it
+  for (i = 0; i < n; i++) {
+    gpiod_direction_input(gpio->bus[i]);
+  }
+  gpiod_set_value(gpio->bus[n], LCD_LEVEL(rs));
+  gpiod_set_value(gpio->rw_desc, LCD_HIGH);
+  lcd->stats.gpio_calls += n + 2;
+
+  if (n == 8) {
+    value = lcdGpio_readNbits(lcd, 8);
+  }
+  else {
+    value = lcdGpio_readNbits(lcd, 4) << 4;
+    value |= lcdGpio_readNbits(lcd, 4);
+  }
+
+  gpiod_set_value(gpio->rw_desc, LCD_LOW);
+  for (i = 0; i < n; i++) {
+    gpiod_direction_output(gpio->bus[i], LCD_LOW);
+  }
+  lcd->stats.gpio_calls += n + 1;
+  return value;
+}
+
+static unsigned char lcdGpio_readNbits(struct lcd *lcd, int n){
+  struct lcd_gpio *gpio = lcd->bus_data;
+  unsigned char value = 0;
+  int i;
+
+  lcdGpio_setEnable(lcd, LCD_HIGH);
+  lcd_wait(lcd, 1);  // data is valid 360ns after the rising edge
+  for (i = 0; i < n; i++) {
+    value |= LCD_LEVEL(gpiod_get_value(gpio->bus[i])) << i;
+  }
+  lcdGpio_setEnable(lcd, LCD_LOW);
+  lcd_wait(lcd, 1);
+  lcd->stats.gpio_calls += n;
+  return value;
+}
@@ -0,0 +1,11 @@
+#ifndef _GPIOROUTINES_H
+#define _GPIOROUTINES_H
+
+#include "lcdroutines.h"
+
+// display wired directly to gpios, RW may be connected to ground
+extern const struct lcd_bus_ops lcd_gpio_ops;
+
+bool lcdGpio_setFastIO(struct lcd *lcd, bool on);
+
+#endif
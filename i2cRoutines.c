@@ -0,0 +1,186 @@
+#include "i2cRoutines.h"
+#include <linux/i2c.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+
+#define LCD_I2C_PADDING 4    // idle bytes a wait may be filled with, longer ones sleep
+#define LCD_I2C_FLUSH   256  // bytes sent to the display by a flush of a full 40x4 frame with its address sets and glyphs
+// bytes of one transfer at most: every byte is 4 enable edges, an RS change and the padding, larger flushes are split
+#define LCD_I2C_BATCH   (LCD_I2C_FLUSH * (5 + LCD_I2C_PADDING))
+
+// state of the i2c backend, lcd->bus_data
+struct lcd_i2c {
+  struct i2c_adapter *adapter;
+  struct i2c_client *client;
+  unsigned char port;          // expander outputs with enable low
+  unsigned int byte_ns;        // one byte and its acknowledge on the wire
+  int batch;                   // bytes of one transfer, less if the adapter cannot send as many
+  int len;
+  unsigned char buf[LCD_I2C_BATCH];
+};
+
+static int  lcdI2c_init(struct lcd *lcd);
+static void lcdI2c_uninit(struct lcd *lcd);
+static void lcdI2c_setLines(struct lcd *lcd, unsigned char value, bool rs);
+static void lcdI2c_pulse(struct lcd *lcd);
+static void lcdI2c_delay(struct lcd *lcd, unsigned int us);
+static void lcdI2c_sync(struct lcd *lcd);
+static void lcdI2c_queue(struct lcd *lcd, unsigned char value);
+
+// RW stays low, the busy flag is not read through the expander
+const struct lcd_bus_ops lcd_i2c_ops = {
+  .name = "i2c",
+  .wire_bits = 9,   // the byte and its acknowledge
+  .init = lcdI2c_init,
+  .uninit = lcdI2c_uninit,
+  .set_lines = lcdI2c_setLines,
+  .pulse = lcdI2c_pulse,
+  .delay = lcdI2c_delay,
+  .sync = lcdI2c_sync,
+};
+
+/**
+ *  @brief Claim the port expander and pull all outputs but the backlight low
+ *  @return 0 on success, -EINVAL in 8 bit mode, -ENODEV without the adapter,
+ *  -EBUSY if the address is taken, -ENOMEM or the error of the first transfer
+ */
+static int lcdI2c_init(struct lcd *lcd){
+  struct lcd_i2c *i2c;
+  int ret;
+
+  if (lcd->pin.nbus != 4) {
+    printk(KERN_ALERT "Lcd: the i2c backpack only wires D4-D7, 4 bit mode is needed\n");
+    return -EINVAL;
+  }
+
+  i2c = kzalloc(sizeof(*i2c), GFP_KERNEL);
+  if (i2c == NULL) {
+    return -ENOMEM;
+  }
+
+  i2c->adapter = i2c_get_adapter(lcd->link.port);
+  if (i2c->adapter == NULL) {
+    printk(KERN_ALERT "Lcd: no i2c adapter %d\n", lcd->link.port);
+    ret = -ENODEV;
+    goto lcd_i2c_free;
+  }
+  i2c->client = i2c_new_dummy(i2c->adapter, lcd->link.addr);
+  if (i2c->client == NULL) {
+    ret = -EBUSY;
+    goto lcd_i2c_put;
+  }
+
+  // the planner weighs the bytes by the clock, see lcd_byteCost()
+  if (lcd->link.khz == 0) {
+    lcd->link.khz = LCD_I2C_KHZ;
+  }
+  i2c->byte_ns = 9000000 / lcd->link.khz;
+  i2c->batch = LCD_I2C_BATCH;
+  if (i2c->adapter->quirks && i2c->adapter->quirks->max_write_len) {
+    i2c->batch = min_t(int, i2c->batch, i2c->adapter->quirks->max_write_len);
+  }
+  lcd->bus_data = i2c;
+
+  // nothing acknowledges the address if the backpack is missing
+  i2c->port = LCD_PORT_BACKLIGHT;
+  ret = i2c_master_send(i2c->client, (const char *)&i2c->port, 1);
+  if (ret < 0) {
+    printk(KERN_ALERT "Lcd: no PCF8574 at %d-%04x (%d)\n", lcd->link.port, lcd->link.addr, ret);
+    goto lcd_i2c_unregister;
+  }
+  lcd->stats.bus_bytes++;
+  lcd->stats.transfers++;
+
+  printk(KERN_INFO "Lcd: PCF8574 at %d-%04x, %u kHz\n", lcd->link.port, lcd->link.addr, lcd->link.khz);
+  return 0;
+
+ lcd_i2c_unregister:
+  lcd->bus_data = NULL;
+  i2c_unregister_device(i2c->client);
+ lcd_i2c_put:
+  i2c_put_adapter(i2c->adapter);
+ lcd_i2c_free:
+  kfree(i2c);
+  return ret;
+}
+
+static void lcdI2c_uninit(struct lcd *lcd){
+  struct lcd_i2c *i2c = lcd->bus_data;
+
+  // all outputs low, the backlight goes off
+  i2c->port = 0;
+  lcdI2c_queue(lcd, i2c->port);
+  lcdI2c_sync(lcd);
+
+  i2c_unregister_device(i2c->client);
+  i2c_put_adapter(i2c->adapter);
+  printk(KERN_INFO "Lcd: PCF8574 at %d-%04x released\n", lcd->link.port, lcd->link.addr);
+
+  kfree(i2c);
+  lcd->bus_data = NULL;
+}
+
+// The data lines go out with the rising edge of enable, only RS needs to be set up before it
+static void lcdI2c_setLines(struct lcd *lcd, unsigned char value, bool rs){
+  struct lcd_i2c *i2c = lcd->bus_data;
+  unsigned char port = ((value & 0x0F) << 4) | (rs ? LCD_PORT_RS : 0) | LCD_PORT_BACKLIGHT;
+
+  if ((port ^ i2c->port) & LCD_PORT_RS) {
+    lcdI2c_queue(lcd, port);
+  }
+  i2c->port = port;
+}
+
+// A byte on the wire is far longer than the 450ns enable pulse
+static void lcdI2c_pulse(struct lcd *lcd){
+  struct lcd_i2c *i2c = lcd->bus_data;
+
+  lcdI2c_queue(lcd, i2c->port | LCD_PORT_ENABLE);
+  lcdI2c_queue(lcd, i2c->port);
+}
+
+/**
+ *  @brief Wait for the display
+ *  The outputs change again one byte after the queued ones at the earliest,
+ *  short waits are filled up with bytes that repeat the outputs. Longer ones
+ *  send the queue and wait on the cpu, see lcd_wait().
+ */
+static void lcdI2c_delay(struct lcd *lcd, unsigned int us){
+  struct lcd_i2c *i2c = lcd->bus_data;
+  unsigned int bytes = DIV_ROUND_UP(us * 1000, i2c->byte_ns);
+
+  if (i2c->len && bytes <= LCD_I2C_PADDING + 1) {
+    while (bytes-- > 1) {
+      lcdI2c_queue(lcd, i2c->port);
+    }
+    return;
+  }
+  lcdI2c_sync(lcd);
+  lcd_wait(lcd, us);
+}
+
+// Send the queued bytes as one transfer
+static void lcdI2c_sync(struct lcd *lcd){
+  struct lcd_i2c *i2c = lcd->bus_data;
+  int ret;
+
+  if (i2c->len == 0) {
+    return;
+  }
+  ret = i2c_master_send(i2c->client, (const char *)i2c->buf, i2c->len);
+  if (ret < 0) {
+    printk_ratelimited(KERN_WARNING "Lcd: i2c transfer of %d bytes failed (%d)\n", i2c->len, ret);
+  }
+  lcd->stats.bus_bytes += i2c->len;
+  lcd->stats.transfers++;
+  i2c->len = 0;
+}
+
+static void lcdI2c_queue(struct lcd *lcd, unsigned char value){
+  struct lcd_i2c *i2c = lcd->bus_data;
+
+  i2c->buf[i2c->len++] = value;
+  if (i2c->len == i2c->batch) {
+    lcdI2c_sync(lcd);
+  }
+}
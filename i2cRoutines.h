@@ -0,0 +1,18 @@
+#ifndef _I2CROUTINES_H
+#define _I2CROUTINES_H
+
+#include "lcdroutines.h"
+
+// PCF8574 i2c backpack, P0-P7 wired as LCD_PORT_RS ... D7
+#define LCD_I2C_ADDR      0x27  // A0-A2 open, 0x3F for the PCF8574A
+#define LCD_I2C_KHZ       100   // standard mode
+
+/**
+ *  Display behind a PCF8574 port expander, always in 4 bit mode and RW held
+ *  low. Every nibble is written as its two enable edges, the bytes of an
+ *  operation go out in one i2c transfer. A flush of a full frame fits, unless
+ *  the adapter limits the length of a transfer.
+ */
+extern const struct lcd_bus_ops lcd_i2c_ops;
+
+#endif
@@ -0,0 +1,299 @@
+/**
+ * @file lcdCharset.c
+ * @brief Unicode to character ROM tables of the HD44780 ROM variants.
+ * A00 is the japanese ROM of doc/lcd_charset.gif, A02 the european one.
+ * All tables are built by the compiler, nothing is computed at runtime.
+ */
+
+#include "lcdCharset.h"
+#include "lcdroutines.h"
+#include <linux/kernel.h>
+
+// table entries: a ROM character, a run of 8 characters, or glyph n with its fallback
+#define LCD_MAP(c, to) [c] = (to)
+#define LCD_MAP8(c, to) \
+  LCD_MAP(c, to), LCD_MAP((c) + 1, (to) + 1), LCD_MAP((c) + 2, (to) + 2), LCD_MAP((c) + 3, (to) + 3), \
+  LCD_MAP((c) + 4, (to) + 4), LCD_MAP((c) + 5, (to) + 5), LCD_MAP((c) + 6, (to) + 6), LCD_MAP((c) + 7, (to) + 7)
+#define LCD_MAP32(c, to) \
+  LCD_MAP8(c, to), LCD_MAP8((c) + 8, (to) + 8), LCD_MAP8((c) + 16, (to) + 16), LCD_MAP8((c) + 24, (to) + 24)
+#define LCD_GLYPH(n, fallback) (((LCD_USER_GLYPHS + (n) + 1) << 8) | (fallback))
+
+// page without a single ROM character
+static const u16 lcd_pageNone[256] = {
+  [0 ... 255] = '?',
+};
+
+/****** A00, japanese ******/
+
+#define A00_BACKSLASH LCD_GLYPH(0, '|')
+#define A00_TILDE     LCD_GLYPH(1, '-')
+#define A00_AUML      LCD_GLYPH(2, 'A')
+#define A00_OUML      LCD_GLYPH(3, 'O')
+#define A00_UUML      LCD_GLYPH(4, 'U')
+#define A00_EURO      LCD_GLYPH(5, 'E')
+
+static const struct lcd_charset_glyph lcd_a00Glyphs[] = {
+  { A00_BACKSLASH, { 0x00, 0x10, 0x08, 0x04, 0x02, 0x01, 0x00, 0x00 } },
+  { A00_TILDE,     { 0x00, 0x00, 0x08, 0x15, 0x02, 0x00, 0x00, 0x00 } },
+  { A00_AUML,      { 0x0A, 0x00, 0x0E, 0x11, 0x1F, 0x11, 0x11, 0x00 } },
+  { A00_OUML,      { 0x0A, 0x00, 0x0E, 0x11, 0x11, 0x11, 0x0E, 0x00 } },
+  { A00_UUML,      { 0x0A, 0x00, 0x11, 0x11, 0x11, 0x11, 0x0E, 0x00 } },
+  { A00_EURO,      { 0x06, 0x09, 0x1C, 0x08, 0x1C, 0x09, 0x06, 0x00 } },
+};
+
+// ASCII and Latin-1, 0x5C is the yen sign and 0x7E, 0x7F are arrows
+static const u16 lcd_a00Page00[256] = {
+  [0 ... 255] = '?',
+  LCD_MAP32(0x20, 0x20), LCD_MAP32(0x40, 0x40), LCD_MAP32(0x60, 0x60),
+  ['\\'] = A00_BACKSLASH, ['~'] = A00_TILDE, [0x7F] = '?',
+  [0xA0] = ' ',  [0xA2] = 0xEC, [0xA3] = 0xED, [0xA5] = 0x5C, [0xB0] = 0xDF, [0xB5] = 0xE4,
+  [0xB7] = 0xA5, [0xC4] = A00_AUML, [0xD6] = A00_OUML, [0xDC] = A00_UUML, [0xDF] = 0xE2,
+  [0xE4] = 0xE1, [0xF1] = 0xEE, [0xF6] = 0xEF, [0xF7] = 0xFD, [0xFC] = 0xF5,
+};
+
+// greek
+static const u16 lcd_a00Page03[256] = {
+  [0 ... 255] = '?',
+  [0xA3] = 0xF6, [0xA9] = 0xF4, [0xB1] = 0xE0, [0xB2] = 0xE2, [0xB5] = 0xE3, [0xB8] = 0xF2,
+  [0xBC] = 0xE4, [0xC0] = 0xF7, [0xC1] = 0xE6, [0xC3] = 0xE5,
+};
+
+// punctuation, currency
+static const u16 lcd_a00Page20[256] = {
+  [0 ... 255] = '?',
+  [0x22] = 0xA5, [0xAC] = A00_EURO,
+};
+
+// arrows, letterlike symbols
+static const u16 lcd_a00Page21[256] = {
+  [0 ... 255] = '?',
+  [0x26] = 0xF4, [0x90] = 0x7F, [0x92] = 0x7E,
+};
+
+// mathematical operators
+static const u16 lcd_a00Page22[256] = {
+  [0 ... 255] = '?',
+  [0x11] = 0xF6, [0x12] = '-', [0x1A] = 0xE8, [0x1E] = 0xF3,
+};
+
+// block elements
+static const u16 lcd_a00Page25[256] = {
+  [0 ... 255] = '?',
+  [0x88] = 0xFF,
+};
+
+// CJK punctuation and katakana, voiced katakana need two cells and are not mapped
+static const u16 lcd_a00Page30[256] = {
+  [0 ... 255] = '?',
+  [0x01] = 0xA4, [0x02] = 0xA1, [0x0C] = 0xA2, [0x0D] = 0xA3, [0x9B] = 0xDE, [0x9C] = 0xDF,
+  [0xA1] = 0xA7, [0xA2] = 0xB1, [0xA3] = 0xA8, [0xA4] = 0xB2, [0xA5] = 0xA9, [0xA6] = 0xB3,
+  [0xA7] = 0xAA, [0xA8] = 0xB4, [0xA9] = 0xAB, [0xAA] = 0xB5, [0xAB] = 0xB6, [0xAD] = 0xB7,
+  [0xAF] = 0xB8, [0xB1] = 0xB9, [0xB3] = 0xBA, [0xB5] = 0xBB, [0xB7] = 0xBC, [0xB9] = 0xBD,
+  [0xBB] = 0xBE, [0xBD] = 0xBF, [0xBF] = 0xC0, [0xC1] = 0xC1, [0xC3] = 0xAF, [0xC4] = 0xC2,
+  [0xC6] = 0xC3, [0xC8] = 0xC4, [0xCA] = 0xC5, [0xCB] = 0xC6, [0xCC] = 0xC7, [0xCD] = 0xC8,
+  [0xCE] = 0xC9, [0xCF] = 0xCA, [0xD2] = 0xCB, [0xD5] = 0xCC, [0xD8] = 0xCD, [0xDB] = 0xCE,
+  [0xDE] = 0xCF, [0xDF] = 0xD0, [0xE0] = 0xD1, [0xE1] = 0xD2, [0xE2] = 0xD3, [0xE3] = 0xAC,
+  [0xE4] = 0xD4, [0xE5] = 0xAD, [0xE6] = 0xD5, [0xE7] = 0xAE, [0xE8] = 0xD6, [0xE9] = 0xD7,
+  [0xEA] = 0xD8, [0xEB] = 0xD9, [0xEC] = 0xDA, [0xED] = 0xDB, [0xEF] = 0xDC, [0xF2] = 0xA6,
+  [0xF3] = 0xDD, [0xFB] = 0xA5, [0xFC] = 0xB0,
+};
+
+// the kanji of the ROM: ten thousand, yen, thousand
+static const u16 lcd_a00Page4E[256] = {
+  [0 ... 255] = '?',
+  [0x07] = 0xFB,
+};
+static const u16 lcd_a00Page51[256] = {
+  [0 ... 255] = '?',
+  [0x86] = 0xFC,
+};
+static const u16 lcd_a00Page53[256] = {
+  [0 ... 255] = '?',
+  [0x43] = 0xFA,
+};
+
+// halfwidth katakana are the ROM codes 0xA1 - 0xDF in the same order
+static const u16 lcd_a00PageFF[256] = {
+  [0 ... 255] = '?',
+  [0x61] = 0xA1, [0x62] = 0xA2, [0x63] = 0xA3, [0x64] = 0xA4, [0x65] = 0xA5, [0x66] = 0xA6,
+  [0x67] = 0xA7, LCD_MAP8(0x68, 0xA8), LCD_MAP32(0x70, 0xB0), LCD_MAP8(0x90, 0xD0),
+  LCD_MAP8(0x98, 0xD8), [0xE5] = 0x5C,
+};
+
+static const u16 *const lcd_a00[256] = {
+  [0 ... 255] = lcd_pageNone,
+  [0x00] = lcd_a00Page00, [0x03] = lcd_a00Page03, [0x20] = lcd_a00Page20, [0x21] = lcd_a00Page21,
+  [0x22] = lcd_a00Page22, [0x25] = lcd_a00Page25, [0x30] = lcd_a00Page30, [0x4E] = lcd_a00Page4E,
+  [0x51] = lcd_a00Page51, [0x53] = lcd_a00Page53, [0xFF] = lcd_a00PageFF,
+};
+
+/****** A02, european ******/
+
+#define A02_EURO LCD_GLYPH(0, 'E')
+
+static const struct lcd_charset_glyph lcd_a02Glyphs[] = {
+  { A02_EURO, { 0x06, 0x09, 0x1C, 0x08, 0x1C, 0x09, 0x06, 0x00 } },
+};
+
+// ASCII and Latin-1, except where the ROM has cyrillic or other symbols
+static const u16 lcd_a02Page00[256] = {
+  [0 ... 255] = '?',
+  LCD_MAP32(0x20, 0x20), LCD_MAP32(0x40, 0x40), LCD_MAP32(0x60, 0x60), [0x7F] = '?',
+  LCD_MAP32(0xA0, 0xA0), LCD_MAP32(0xC0, 0xC0), LCD_MAP32(0xE0, 0xE0),
+  [0xA0] = ' ', [0xA8] = '?', [0xAC] = '?', [0xAD] = '-', [0xAF] = '?', [0xB4] = '?', [0xB8] = '?',
+};
+
+// latin extended: florin
+static const u16 lcd_a02Page01[256] = {
+  [0 ... 255] = '?',
+  [0x92] = 0xA8,
+};
+
+// greek
+static const u16 lcd_a02Page03[256] = {
+  [0 ... 255] = '?',
+  [0x93] = 0x92, [0x98] = 0x99, [0xA3] = 0x94, [0xA9] = 0x9A, [0xB1] = 0x90, [0xB4] = 0x9B,
+  [0xB5] = 0x9E, [0xBC] = 0xB5, [0xC0] = 0x93, [0xC3] = 0x95, [0xC4] = 0x97, [0xC9] = 0xB8,
+};
+
+// cyrillic, letters that look like latin ones use those
+static const u16 lcd_a02Page04[256] = {
+  [0 ... 255] = '?',
+  [0x10] = 'A',  [0x11] = 0x80, [0x12] = 'B',  [0x13] = 0x92, [0x14] = 0x81, [0x15] = 'E',
+  [0x16] = 0x82, [0x17] = 0x83, [0x18] = 0x84, [0x19] = 0x85, [0x1A] = 'K',  [0x1B] = 0x86,
+  [0x1C] = 'M',  [0x1D] = 'H',  [0x1E] = 'O',  [0x1F] = 0x87, [0x20] = 'P',  [0x21] = 'C',
+  [0x22] = 'T',  [0x23] = 0x88, [0x25] = 'X',  [0x26] = 0x89, [0x27] = 0x8A, [0x28] = 0x8B,
+  [0x29] = 0x8C, [0x2A] = 0x8D, [0x2B] = 0x8E, [0x2D] = 0x8F, [0x2E] = 0xAC, [0x2F] = 0xAD,
+  [0x30] = 'a',  [0x35] = 'e',  [0x3E] = 'o',  [0x40] = 'p',  [0x41] = 'c',  [0x43] = 'y',
+  [0x45] = 'x',
+};
+
+// punctuation, currency
+static const u16 lcd_a02Page20[256] = {
+  [0 ... 255] = '?',
+  [0x1C] = 0x12, [0x1D] = 0x13, [0x22] = 0x16, [0xAC] = A02_EURO,
+};
+
+// arrows, letterlike symbols
+static const u16 lcd_a02Page21[256] = {
+  [0 ... 255] = '?',
+  [0x26] = 0x9A, [0x90] = 0x1B, [0x91] = 0x18, [0x92] = 0x1A, [0x93] = 0x19, [0xB5] = 0x17,
+};
+
+// mathematical operators
+static const u16 lcd_a02Page22[256] = {
+  [0 ... 255] = '?',
+  [0x11] = 0x94, [0x12] = '-', [0x1E] = 0x9C, [0x29] = 0x9F, [0x64] = 0x1C, [0x65] = 0x1D,
+};
+
+// house
+static const u16 lcd_a02Page23[256] = {
+  [0 ... 255] = '?',
+  [0x02] = 0x7F,
+};
+
+// geometric shapes
+static const u16 lcd_a02Page25[256] = {
+  [0 ... 255] = '?',
+  [0xB2] = 0x1E, [0xB6] = 0x10, [0xBC] = 0x1F, [0xC0] = 0x11, [0xCF] = 0x16,
+};
+
+// notes and the heart
+static const u16 lcd_a02Page26[256] = {
+  [0 ... 255] = '?',
+  [0x65] = 0x9D, [0x6A] = 0x91, [0x6B] = 0x96,
+};
+
+static const u16 *const lcd_a02[256] = {
+  [0 ... 255] = lcd_pageNone,
+  [0x00] = lcd_a02Page00, [0x01] = lcd_a02Page01, [0x03] = lcd_a02Page03, [0x04] = lcd_a02Page04,
+  [0x20] = lcd_a02Page20, [0x21] = lcd_a02Page21, [0x22] = lcd_a02Page22, [0x23] = lcd_a02Page23,
+  [0x25] = lcd_a02Page25, [0x26] = lcd_a02Page26,
+};
+
+// length of a sequence by the upper 5 bits of its first byte, 0: cannot start one
+static const unsigned char lcd_utf8Length[32] = {
+  1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+  0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 3, 3, 4, 0,
+};
+
+static const struct lcd_charset lcd_charsets[] = {
+  { "a00", lcd_a00, lcd_a00Glyphs, ARRAY_SIZE(lcd_a00Glyphs) },
+  { "a02", lcd_a02, lcd_a02Glyphs, ARRAY_SIZE(lcd_a02Glyphs) },
+  { "raw", NULL,    NULL,          0 },
+};
+
+/**
+ *  @brief Character set of a ROM variant
+ *  @param name "a00", "a02" or "raw" for no translation
+ *  @return the character set, NULL if the name is unknown
+ */
+const struct lcd_charset *lcd_findCharset(const char *name){
+  unsigned int i;
+
+  for (i = 0; i < ARRAY_SIZE(lcd_charsets); i++) {
+    if (!strcmp(lcd_charsets[i].name, name)) {
+      return &lcd_charsets[i];
+    }
+  }
+  return NULL;
+}
+
+/**
+ *  @brief Feed one byte of UTF-8 text to the character set
+ *  Bytes that are not UTF-8, like ROM codes written by older programs, are
+ *  taken as they are, so are the bytes of a sequence that breaks off.
+ *  @param out room for LCD_UTF8_OUT table entries
+ *  @return number of entries the byte completes
+ */
+int lcd_decodeUtf8(const struct lcd_charset *charset, struct lcd_utf8 *utf8, unsigned char c, u16 *out){
+  int n = 0, len;
+  u32 cp;
+
+  if (!charset->page) {
+    out[0] = c;
+    return 1;
+  }
+
+  if (utf8->need) {
+    if ((c & 0xC0) == 0x80) {
+      utf8->raw[utf8->len++] = c;
+      utf8->codepoint = (utf8->codepoint << 6) | (c & 0x3F);
+      if (--utf8->need) {
+	return 0;
+      }
+      utf8->len = 0;
+      cp = (utf8->codepoint > 0xFFFF) ? 0xFFFD : utf8->codepoint;   // beyond the tables, shows '?'
+      out[0] = charset->page[cp >> 8][cp & 0xFF];
+      return 1;
+    }
+    n = lcd_breakUtf8(utf8, out);
+  }
+
+  len = lcd_utf8Length[c >> 3];
+  if (len == 1) {
+    out[n] = charset->page[0][c];
+    return n + 1;
+  }
+  if (len == 0) {
+    out[n] = c;
+    return n + 1;
+  }
+  utf8->codepoint = c & (0x7F >> len);
+  utf8->need = len - 1;
+  utf8->raw[0] = c;
+  utf8->len = 1;
+  return n;
+}
+
+// End a sequence that is still open, its bytes are taken as they are
+int lcd_breakUtf8(struct lcd_utf8 *utf8, u16 *out){
+  int i, n = utf8->len;
+
+  for (i = 0; i < n; i++) {
+    out[i] = utf8->raw[i];
+  }
+  utf8->need = 0;
+  utf8->len = 0;
+  return n;
+}
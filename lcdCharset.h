@@ -0,0 +1,42 @@
+#ifndef _LCDCHARSET_H
+#define _LCDCHARSET_H
+
+#include <linux/types.h>
+
+// glyphs a character set brings for characters its ROM lacks, numbered after the registered glyphs
+#define LCD_CHARSET_GLYPHS 16
+
+// glyph of a character set, number and fallback are taken from the table entry
+struct lcd_charset_glyph {
+  u16 entry;
+  unsigned char bitmap[8];
+};
+
+/**
+ *  Translation of unicode into the character ROM of a panel. An entry holds
+ *  the character code in the low byte and the glyph + 1 in the high byte, a
+ *  character costs one lookup and no decision. Characters the ROM lacks show
+ *  a glyph of the character set or '?'. The tables cover U+0000 - U+FFFF.
+ */
+struct lcd_charset {
+  const char *name;
+  const u16 *const *page;                  // 256 pages of 256 entries, NULL: bytes are sent as they are
+  const struct lcd_charset_glyph *glyph;
+  unsigned int glyphs;
+};
+
+// UTF-8 sequence being decoded
+struct lcd_utf8 {
+  u32 codepoint;
+  unsigned char need;        // continuation bytes still missing
+  unsigned char len;
+  unsigned char raw[4];      // bytes of the sequence, sent as they are if it breaks
+};
+
+#define LCD_UTF8_OUT 4       // entries a byte may complete
+
+const struct lcd_charset *lcd_findCharset(const char *name);
+int lcd_decodeUtf8(const struct lcd_charset *charset, struct lcd_utf8 *utf8, unsigned char c, u16 *out);
+int lcd_breakUtf8(struct lcd_utf8 *utf8, u16 *out);
+
+#endif
@@ -11,18 +11,157 @@
  */
 
 #include "devroutines.h"
+#include "gpioRoutines.h"
+#include "i2cRoutines.h"
+#include "spiRoutines.h"
 #include "lcdroutines.h"
 
 #include <linux/init.h>           // Macros used to mark up functions e.g. __init __exit
 #include <linux/module.h>         // Core header for loading LKMs into the kernel
 #include <linux/kernel.h>         // Contains types, macros, functions for the kernel
 #include <linux/string.h>
+#include <linux/slab.h>
 
 MODULE_LICENSE("GPL");                  ///< The license type -- this affects available functionality
 MODULE_AUTHOR("Christoph Gadinger");    ///< The author -- visible when you use modinfo
 MODULE_DESCRIPTION("lcd Module");       ///< The description -- see modinfo
 MODULE_VERSION("17.08.14");             ///< A version number to inform users
 
+static bool fastio = false;             ///< Drive the pins through the gpio bank registers
+module_param(fastio, bool, S_IRUGO);
+MODULE_PARM_DESC(fastio, " Write the AM335x gpio bank registers directly (default=false)");
+
+static char *panels = NULL;             ///< Geometry and pins of the displays
+module_param(panels, charp, S_IRUGO);
+MODULE_PARM_DESC(panels, " Displays separated by ';', each as cols,rows,fourbitmode,rs,rw,enable,d0,...,d7"
+		 " (rw=255: RW connected to ground, default=20,2,0,66,67,69,68,45,44,26,47,46,27,65)"
+		 " or i2c:adapter,address,cols,rows for a PCF8574 backpack or spi:bus,chipselect,cols,rows for a 74HC595");
+
+static unsigned int i2c_khz = LCD_I2C_KHZ;   ///< Clock of the i2c adapters
+module_param(i2c_khz, uint, S_IRUGO);
+MODULE_PARM_DESC(i2c_khz, " Clock of the i2c adapters the backpacks are on, paces the waits (default=100)");
+
+static unsigned int spi_khz = LCD_SPI_KHZ;   ///< Clock of the shift registers
+module_param(spi_khz, uint, S_IRUGO);
+MODULE_PARM_DESC(spi_khz, " Clock the 74HC595 shift registers are written with (default=1000)");
+
+static char *controller = "hd44780";   ///< Timing profile of the controllers
+module_param(controller, charp, S_IRUGO);
+MODULE_PARM_DESC(controller, " Controller timing of all displays: hd44780, ks0066, st7066u or splc780 (default=hd44780)");
+
+static char *charset = "a00";           ///< Character ROM of the displays
+module_param(charset, charp, S_IRUGO);
+MODULE_PARM_DESC(charset, " Character ROM UTF-8 text is translated to: a00 (japanese), a02 (european)"
+		 " or raw to send the bytes as they are (default=a00)");
+
+// the display of the original wiring, used if no panels are given
+static const struct lcd_config default_panel = {
+  .cols = 20,
+  .rows = 2,
+  .fourbitmode = false,
+  .rs = 66,
+  .rw = 67,               // set to 255 for allways write, i.e. wire is connected to ground
+  .enable = 69,
+  .data = { 68, 45, 44, 26, 47, 46, 27, 65 },
+};
+
+/** @brief Parse one display of the panels parameter
+ *  @param str cols,rows,fourbitmode,rs,rw,enable,d0,...,d7 (d4-d7 may be omitted in 4 bit mode)
+ *  @return returns 0 if successful
+ */
+static int __init lcddrv_parsePanel(const char *str, struct lcd_config *config){
+  int ints[15];
+  int i;
+
+  get_options(str, ARRAY_SIZE(ints), ints);
+  if(ints[0] < 10 || (!ints[3] && ints[0] < 14)) {
+    return -EINVAL;
+  }
+  if(ints[1] < 1 || ints[1] > LCD_MAX_COLS || ints[2] < 1 || ints[2] > LCD_MAX_ROWS) {
+    return -EINVAL;
+  }
+
+  memset(config, 0, sizeof(*config));
+  config->cols = ints[1];
+  config->rows = ints[2];
+  config->fourbitmode = ints[3];
+  config->rs = ints[4];
+  config->rw = ints[5];
+  config->enable = ints[6];
+  for(i = 0; i < 8; i++) {
+    config->data[i] = (i + 7 <= ints[0]) ? ints[i + 7] : 0;
+  }
+  config->bus = &lcd_gpio_ops;
+  return 0;
+}
+
+/** @brief Parse one display on a serial backpack of the panels parameter
+ *  @param str adapter,address,cols,rows or bus,chipselect,cols,rows without the leading "i2c:" or "spi:"
+ *  @return returns 0 if successful
+ */
+static int __init lcddrv_parseSerialPanel(const char *str, const struct lcd_bus_ops *bus,
+					  unsigned int khz, struct lcd_config *config){
+  int ints[5];
+
+  get_options(str, ARRAY_SIZE(ints), ints);
+  if(ints[0] < 4 || ints[1] < 0 || ints[2] < 0) {
+    return -EINVAL;
+  }
+  if(bus == &lcd_i2c_ops && (ints[2] < 0x03 || ints[2] > 0x77)) {
+    return -EINVAL;
+  }
+  if(ints[3] < 1 || ints[3] > LCD_MAX_COLS || ints[4] < 1 || ints[4] > LCD_MAX_ROWS) {
+    return -EINVAL;
+  }
+
+  memset(config, 0, sizeof(*config));
+  config->cols = ints[3];
+  config->rows = ints[4];
+  config->fourbitmode = true;
+  config->rw = 255;
+  config->port = ints[1];
+  config->addr = ints[2];
+  config->khz = khz;
+  config->bus = bus;
+  return 0;
+}
+
+/** @brief Bring up one display and greet with the init message
+ */
+static int __init lcddrv_addPanel(unsigned int minor, const struct lcd_config *panel){
+  static char greeting[] = "  *     LCD     *  \n  * initialized *";
+  struct lcd_config config = *panel;
+  struct lcd_dev *dev;
+
+  config.controller = controller;
+  config.charset = charset;
+  if(config.bus == NULL) {
+    config.bus = &lcd_gpio_ops;
+  }
+  dev = dev_add(minor, &config);
+  if(IS_ERR(dev)) {
+    return PTR_ERR(dev);
+  }
+
+  // the device is already visible, take the locks like every other user
+  mutex_lock(&dev->bus_lock);
+  if(config.bus == &lcd_gpio_ops) {
+    lcdGpio_setFastIO(&dev->lcd, fastio);
+  }
+  
+  lcd_cursor(&dev->lcd);
+  //  lcd_blink(&dev->lcd);
+  //  lcd_rightToLeft(&dev->lcd);
+  //  lcd_autoscroll(&dev->lcd);
+  //  lcd_scrollDisplayLeft(&dev->lcd);
+  mutex_unlock(&dev->bus_lock);
+
+  spin_lock(&dev->frame_lock);
+  lcd_render(&dev->lcd, greeting, sizeof(greeting) - 1);
+  spin_unlock(&dev->frame_lock);
+  dev_scheduleFlush(dev);
+  return 0;
+}
 
 /** @brief The LKM initialization function
  *  The static keyword restricts the visibility of the function to within this C file. The __init
@@ -31,28 +170,53 @@ MODULE_VERSION("17.08.14");             ///< A version number to inform users
  *  @return returns 0 if successful
  */
 static int __init lcddrv_init(void){
+  struct lcd_config config;
+  char *list, *next, *str;
+  unsigned int minor = 0;
   int retVal = 0;
 
   retVal = dev_init();
   if(retVal) {
     return retVal;
   }
-  
-  // 1.    : fourbitmode
-  // 2.    : rs_pinNr
-  // 3.    : rw_pinNr (set to 255 for allways read, i.e. wire is connected to ground)
-  // 4.    : enable_pinNr
-  // [5-12]: data_pinNr[0-7]
-  //  lcd_init(true, 66, 67, 69, 68, 45, 44, 26, 47, 46, 27, 65);
-  lcd_init(20, 2, false, 66, 67, 69, 68, 45, 44, 26, 47, 46, 27, 65);
-  
-  lcd_cursor();
-  //  lcd_blink();
-  //  lcd_rightToLeft();
-  //  lcd_autoscroll();
-  //  lcd_scrollDisplayLeft();
-  lcd_update("  *     LCD     *  \n  * initialized *");
-  
+
+  if(panels == NULL) {
+    retVal = lcddrv_addPanel(0, &default_panel);
+    goto lcddrv_init_exit;
+  }
+
+  // keep the parameter intact for /sys/module, strsep() modifies the string
+  list = next = kstrdup(panels, GFP_KERNEL);
+  if(list == NULL) {
+    retVal = -ENOMEM;
+    goto lcddrv_init_exit;
+  }
+  while((str = strsep(&next, ";")) != NULL && !retVal) {
+    if(*str == '\0') {
+      continue;
+    }
+    if(!strncmp(str, "i2c:", 4)) {
+      retVal = lcddrv_parseSerialPanel(str + 4, &lcd_i2c_ops, i2c_khz, &config);
+    }
+    else if(!strncmp(str, "spi:", 4)) {
+      retVal = lcddrv_parseSerialPanel(str + 4, &lcd_spi_ops, spi_khz, &config);
+    }
+    else {
+      retVal = lcddrv_parsePanel(str, &config);
+    }
+    if(retVal) {
+      printk(KERN_ALERT "Lcd: invalid panel \"%s\"\n", str);
+      break;
+    }
+    retVal = lcddrv_addPanel(minor++, &config);
+  }
+  kfree(list);
+
+ lcddrv_init_exit:
+  if(retVal) {
+    dev_destroy();
+    return retVal;
+  }
   printk(KERN_INFO "Lcd: _init success\n");
   
   return 0;
@@ -63,8 +227,7 @@ static int __init lcddrv_init(void){
  *  code is used for a built-in driver (not a LKM) that this function is not required.
  */
 static void __exit lcddrv_exit(void){
-  lcd_uninit();
-
+  // removes the devices and releases the pins of all displays
   dev_destroy();
   
   printk(KERN_INFO "Lcd: _exit success\n");
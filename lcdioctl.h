@@ -0,0 +1,81 @@
+/**
+ * @file lcdioctl.h
+ * @brief ioctl interface of /dev/lcdchar, shared with userspace programs.
+ *
+ * The rendered frame can be mapped with mmap(MAP_SHARED): one page holding rows * cols
+ * character codes, row by row. Changes are sent to the display after
+ * LCD_IOC_COMMIT, only cells that differ from the display content are written.
+ *
+ * LCD_IOC_BATCH runs up to LCD_BATCH_MAX operations in one call. The batch is
+ * checked as a whole before anything is done, then it runs without other
+ * writers in between and the result is on the display when the call returns.
+ *
+ * read() returns the committed frame as text, poll() reports POLLIN once a
+ * frame with other characters has been flushed since the last read from offset
+ * 0. LCD_IOC_GENERATION returns the number of such frames, so readers can skip
+ * frames they already have.
+ *
+ * Registered glyphs (LCD_OP_GLYPH) get one of the 8 custom characters while
+ * they are on the display. If more glyphs are visible than there are free
+ * custom characters, the rest show their fallback character.
+ */
+
+#ifndef _LCDIOCTL_H
+#define _LCDIOCTL_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define LCD_IOC_MAGIC 0xB5
+
+struct lcd_geometry {
+  __u8 rows;
+  __u8 cols;
+};
+
+#define LCD_BATCH_MAX 64   // operations per LCD_IOC_BATCH
+#define LCD_OP_DATA   40   // characters of one write run
+
+// lcd_op.code
+#define LCD_OP_CURSOR  1   // move the cursor to col, row
+#define LCD_OP_WRITE   2   // write len characters of data at the cursor, no escape characters
+#define LCD_OP_CHAR    3   // custom character arg (0-7), data[0..7] holds the rows
+#define LCD_OP_CONTROL 4   // display control, arg: LCD_CTRL_* flags
+#define LCD_OP_ENTRY   5   // entry mode, arg: LCD_ENTRY_* flags
+#define LCD_OP_SHIFT   6   // shift display or cursor by one, arg: LCD_SHIFT_* flags
+#define LCD_OP_GLYPH   7   // register glyph arg, data[0..7] holds the rows, data[8] the fallback character
+#define LCD_OP_ICON    8   // put glyph arg at the cursor
+
+#define LCD_GLYPH_COUNT 64 // glyphs that can be registered, they share the 8 custom characters
+
+// lcd_op.arg flags, these are the bits of the controller instructions
+#define LCD_CTRL_DISPLAY    0x04
+#define LCD_CTRL_CURSOR     0x02
+#define LCD_CTRL_BLINK      0x01
+#define LCD_ENTRY_INCREMENT 0x02   // text flows left to right
+#define LCD_ENTRY_SHIFT     0x01   // autoscroll
+#define LCD_SHIFT_DISPLAY   0x08   // shift the display instead of the cursor
+#define LCD_SHIFT_RIGHT     0x04
+
+struct lcd_op {
+  __u8 code;
+  __u8 arg;
+  __u8 col;
+  __u8 row;
+  __u8 len;
+  __u8 reserved[3];
+  __u8 data[LCD_OP_DATA];
+};
+
+struct lcd_batch {
+  __u64 ops;        // pointer to count struct lcd_op
+  __u32 count;
+  __u32 reserved;
+};
+
+#define LCD_IOC_GEOMETRY _IOR(LCD_IOC_MAGIC, 0, struct lcd_geometry)
+#define LCD_IOC_COMMIT   _IO(LCD_IOC_MAGIC, 1)
+#define LCD_IOC_BATCH    _IOW(LCD_IOC_MAGIC, 2, struct lcd_batch)
+#define LCD_IOC_GENERATION _IOR(LCD_IOC_MAGIC, 3, __u64)
+
+#endif
@@ -1,195 +1,225 @@
 
 #include "lcdroutines.h"
 #include <linux/delay.h>
-#include <linux/gpio.h>
 #include <linux/kernel.h>
+#include <linux/gfp.h>
+#include <linux/ktime.h>
 
-static struct{
-  unsigned char rs; // LOW: command.  HIGH: character.
-  unsigned char rw; // LOW: write to LCD.  HIGH: read from LCD.
-  unsigned char enable; // activated by a HIGH pulse.
-  unsigned char data[8];
-} _pin;
-
-static struct{
-  unsigned char function;
-  unsigned char control;
-  unsigned char mode;
-} _display;
- 
-static struct{
-  unsigned char row_max;
-  unsigned char col_max;
-  unsigned char row_offsets[4];
-  unsigned char row;
-  unsigned char col;
-} _cursor;
-
+#define CREATE_TRACE_POINTS
+#include "lcdtrace.h"
 
 /****** low level data pushing commands ******/  
-static void lcd_send(unsigned char value, unsigned char mode);
-static void lcd_write4bits(unsigned char value);
-static void lcd_write8bits(unsigned char value);
-static void lcd_pulseEnable(void);
+static void lcd_send(struct lcd *lcd, unsigned char value, unsigned char mode);
+static void lcd_sendWait(struct lcd *lcd, unsigned char value, unsigned char mode, unsigned int us);
+static void lcd_traceSend(struct lcd *lcd, unsigned char value, unsigned char mode, u64 elapsed_ns);
+static void lcd_write4bits(struct lcd *lcd, unsigned char value, unsigned char mode);
+static void lcd_write8bits(struct lcd *lcd, unsigned char value, unsigned char mode);
+static void lcd_pulseEnable(struct lcd *lcd);
+static void lcd_delay(struct lcd *lcd, unsigned int us);
+static void lcd_holdBus(struct lcd *lcd);
+static void lcd_releaseBus(struct lcd *lcd);
+static void lcd_syncBus(struct lcd *lcd);
+
+/****** low level data reading commands ******/
+static void lcd_waitBusy(struct lcd *lcd, unsigned int us);
+static bool lcd_checkRead(struct lcd *lcd);
+static unsigned char lcd_readData(struct lcd *lcd);
+
+/****** shadow framebuffer ******/
+static void lcd_putc(struct lcd *lcd, unsigned char value);
+static void lcd_setAddr(struct lcd *lcd, unsigned char addr);
+static void lcd_advanceAddr(struct lcd *lcd);
+static void lcd_clearDisplay(struct lcd *lcd);
+static unsigned char lcd_lineWidth(struct lcd *lcd);
+static unsigned char lcd_cellAddr(struct lcd *lcd, unsigned char row, unsigned char col, unsigned char view);
+static void lcd_moveDisplay(struct lcd *lcd, unsigned char flags);
+static unsigned char lcd_shiftDistance(struct lcd *lcd, unsigned char from, unsigned char to);
+static void lcd_shiftTo(struct lcd *lcd, unsigned char view);
+
+/****** update planner ******/
+static unsigned char lcd_nextChar(struct lcd *lcd, int i);
+static void lcd_flushCells(struct lcd *lcd);
+static void lcd_flushMarquee(struct lcd *lcd, unsigned char view);
+static void lcd_flushCursor(struct lcd *lcd, unsigned char view);
+static void lcd_flushPlanned(struct lcd *lcd, bool reset);
+static void lcd_planTarget(struct lcd *lcd, unsigned char view);
+static unsigned long lcd_planWalk(struct lcd *lcd, unsigned char view, bool blank, bool send);
+static unsigned int lcd_byteCost(struct lcd *lcd, unsigned int us);
+static unsigned char lcd_walkAddr(struct lcd *lcd, int i);
+static int  lcd_walkIndex(struct lcd *lcd, unsigned char addr);
+static void lcd_renderChar(struct lcd *lcd, unsigned char c, unsigned char glyph);
+static void lcd_renderEntries(struct lcd *lcd, const u16 *entry, int n);
+static void lcd_setCharset(struct lcd *lcd, const struct lcd_charset *charset);
+static void lcd_writeCGRAM(struct lcd *lcd, unsigned char slot, const unsigned char bitmap[8]);
+static void lcd_loadGlyphs(struct lcd *lcd);
+static int  lcd_pickSlot(struct lcd *lcd, const bool *visible);
 
 /****** div. functions for display initialization ******/
-static void lcd_begin(unsigned char cols, unsigned char rows, unsigned char charsize);
-static void lcd_setRowOffsets(int row1, int row2, int row3, int row4);
+static void lcd_begin(struct lcd *lcd, unsigned char cols, unsigned char rows, unsigned char charsize);
+static void lcd_initController(struct lcd *lcd);
+static bool lcd_probeAddr(struct lcd *lcd);
+static void lcd_setRowOffsets(struct lcd *lcd, int row1, int row2, int row3, int row4);
+
+// datasheet execution times at the nominal oscillator frequency
+static const struct lcd_timing lcd_timings[] = {
+  //  name       clear  home  command  data  pulse
+  { "hd44780",   1520,  1520,  37,     41,   1 },
+  { "ks0066",    1530,  1530,  39,     43,   1 },
+  { "st7066u",   1520,  1520,  37,     41,   1 },
+  { "splc780",   1640,  1640,  40,     46,   1 },
+};
 
 /** 
  *  @brief Initialize the lcd display
- *  @param unsigned char $fourbitmode 
- *  @param unsigned char $rs
- *  @param unsigned char $rw
- *  @param unsigned char $enable
- *  @param unsigned char $d0:$d7
+ *  @param struct lcd $lcd state of the display, zeroed by the caller
+ *  @param struct lcd_config $config geometry and pins
+ *  @return 0 on success, -ENOMEM if there is no page for the frame,
+ *  -EINVAL for more cells than one controller holds, an unknown controller
+ *  or character set or the error of the bus backend
  */
-void lcd_init(unsigned char cols, unsigned char lines,
-	      unsigned char fourbitmode, unsigned char rs, unsigned char rw, unsigned char enable,
-	      unsigned char d0, unsigned char d1, unsigned char d2, unsigned char d3,
-	      unsigned char d4, unsigned char d5, unsigned char d6, unsigned char d7){  
+int lcd_init(struct lcd *lcd, const struct lcd_config *config){
+  int ret;
+
+  // the rows and columns are checked on their own by the caller, 40x4 takes two controllers
+  if (config->cols * config->rows > LCD_DDRAM_CELLS) {
+    return -EINVAL;
+  }
+
+  // the rendered frame gets a page of its own, so it can be mapped to userspace
+  lcd->frame.cell = (unsigned char *)get_zeroed_page(GFP_KERNEL);
+  if (lcd->frame.cell == NULL) {
+    return -ENOMEM;
+  }
   
-  _pin.rs = rs;
-  _pin.rw = rw;
-  _pin.enable = enable;
-
-  _pin.data[0] = d0;
-  _pin.data[1] = d1;
-  _pin.data[2] = d2;
-  _pin.data[3] = d3;
-  _pin.data[4] = d4;
-  _pin.data[5] = d5;
-  _pin.data[6] = d6;
-  _pin.data[7] = d7;
-
-  if (fourbitmode) {
-    _display.function = LCD_4BITMODE | LCD_1LINE | LCD_5x8DOTS;
+  lcd->pin.rs = config->rs;
+  lcd->pin.rw = config->rw;
+  lcd->pin.enable = config->enable;
+  memcpy(lcd->pin.data, config->data, sizeof(lcd->pin.data));
+  lcd->link.port = config->port;
+  lcd->link.addr = config->addr;
+  lcd->link.khz = config->khz;
+
+  lcd->timing = lcd_timings[0];
+  if (config->controller) {
+    const struct lcd_timing *timing = lcd_findTiming(config->controller);
+    if (timing == NULL) {
+      free_page((unsigned long)lcd->frame.cell);
+      return -EINVAL;
+    }
+    lcd->timing = *timing;
+  }
+
+  lcd_setCharset(lcd, lcd_findCharset(config->charset ? config->charset : "a00"));
+  if (lcd->charset == NULL) {
+    free_page((unsigned long)lcd->frame.cell);
+    return -EINVAL;
+  }
+
+  // the busy flag cannot be checked before the initialization is done
+  lcd->pin.busyflag = false;
+  lcd->pin.nbus = config->fourbitmode ? 4 : 8;
+
+  if (config->fourbitmode) {
+    lcd->display.function = LCD_4BITMODE | LCD_1LINE | LCD_5x8DOTS;
   }
   else {
-    _display.function = LCD_8BITMODE | LCD_1LINE | LCD_5x8DOTS;
+    lcd->display.function = LCD_8BITMODE | LCD_1LINE | LCD_5x8DOTS;
+  }
+
+  lcd->frame.plan = true;
+
+  lcd->bus = config->bus;
+  ret = lcd->bus->init(lcd);
+  if (ret) {
+    free_page((unsigned long)lcd->frame.cell);
+    return ret;
   }
   
   // begin initializing the lcd
-  lcd_begin(cols, lines, LCD_5x8DOTS);
+  lcd_begin(lcd, config->cols, config->rows, LCD_5x8DOTS);
+  return 0;
 }
 
-void lcd_uninit(void){
-  int i;
-
+void lcd_uninit(struct lcd *lcd){
   // clear the display
-  lcd_clear();
-
-  // set all gpios to 0
-  gpio_set_value(_pin.rs, 0);
-  gpio_set_value(_pin.rw, 0);
-  gpio_set_value(_pin.enable, 0);
+  lcd_clear(lcd);
 
-  // unexport all gpios
-  gpio_unexport(_pin.rs);
-  gpio_unexport(_pin.rw);
-  gpio_unexport(_pin.enable);
+  lcd->bus->uninit(lcd);
 
-  // free all gpios
-  gpio_free(_pin.rs);
-  gpio_free(_pin.rw);
-  gpio_free(_pin.enable);
-
-  // do the previous 3 steps for all datapins
-  for (i = 0; i<((_display.function & LCD_8BITMODE) ? 8 : 4); i++) {
-    gpio_set_value(_pin.data[i], 0);
-    gpio_unexport(_pin.data[i]);
-    gpio_free(_pin.data[i]);
-  }
-  
-  printk(KERN_INFO "Lcd: all lcd-pins unexported\n");
+  free_page((unsigned long)lcd->frame.cell);
+  lcd->frame.cell = NULL;
 }
 
-void lcd_begin(unsigned char cols, unsigned char lines, unsigned char dotsize){
-  int i = 0;
+void lcd_begin(struct lcd *lcd, unsigned char cols, unsigned char lines, unsigned char dotsize){
   if (lines > 1) {
-    _display.function |= LCD_2LINE;
+    lcd->display.function |= LCD_2LINE;
   }
   
-  _cursor.row_max = lines;
-  _cursor.col_max = cols;
+  lcd->cursor.row_max = lines;
+  lcd->cursor.col_max = cols;
 
-  _cursor.row = 0;
-  _cursor.col = 0;
+  lcd->cursor.row = 0;
+  lcd->cursor.col = 0;
   
-  lcd_setRowOffsets(0x00, 0x40, 0x00 + cols, 0x40 + cols);
+  lcd_setRowOffsets(lcd, 0x00, 0x40, 0x00 + cols, 0x40 + cols);
+
+  // the DDRAM content is unknown until the display has been cleared
+  lcd->frame.addr_valid = false;
+  lcd->frame.clear = false;
+  lcd->frame.next_clear = false;
+  memset(lcd->frame.cell, ' ', LCD_FRAME_SIZE);
   
   // for some 1 line displays you can select a 10 pixel high font
   if ((dotsize != LCD_5x8DOTS) && (lines == 1)) {
     printk(KERN_INFO "Lcd: character font size = 5x10-Dots\n");
-    _display.function |= LCD_5x10DOTS;
+    lcd->display.function |= LCD_5x10DOTS;
   }
   else {
     printk(KERN_INFO "Lcd: caracter font size = 5x8-Dots\n");
   }
-  
-  // setup rs pin
-  gpio_request(_pin.rs, "sysfs");
-  gpio_direction_output(_pin.rs, LCD_LOW);
-  gpio_export(_pin.rs, false);
-
-  // we can save 1 pin by not using RW. Indicate by passing 255 instead of pin#
-  if (_pin.rw != 255) {
-    printk(KERN_INFO "Lcd: READ/WRITE pin (RW) is supposed to be driven by gpio%d\n", _pin.rs);
-    gpio_request(_pin.rw, "sysfs");
-    gpio_direction_output(_pin.rw, LCD_LOW);
-    gpio_export(_pin.rw, false);
-  }
-  else{
-    printk(KERN_INFO "Lcd: READ/WRITE pin (RW) is supposed do be connected to ground (GND)\n");
-  }
-
-  gpio_request(_pin.enable, "sysfs");
-  gpio_direction_output(_pin.enable, LCD_LOW);
-  gpio_export(_pin.enable, false);
-
-  // echo all pin connections
-  printk(KERN_INFO "Lcd: _pin.rs == %d\n", _pin.rs);
-  printk(KERN_INFO "Lcd: _pin.rw == %d\n", _pin.rw);
-  printk(KERN_INFO "Lcd: _pin.enable == %d\n", _pin.enable);
-  
-  // do these once, instead of every time a character is drawn for speed reasons.
-  for (i=0; i<((_display.function & LCD_8BITMODE) ? 8 : 4); i++) {
-    printk(KERN_INFO "Lcd: _pin.data[%d] == %d\n", i, _pin.data[i]);
-    gpio_request(_pin.data[i], "sysfs");
-    gpio_direction_output(_pin.data[i], LCD_LOW);
-    gpio_export(_pin.data[i], false);
-  }
+
+  // turn the display on with no cursor or blinking default
+  lcd->display.control = LCD_DISPLAYON | LCD_CURSOROFF | LCD_BLINKOFF;
+  // initialize to default text direction (for romance languages)
+  lcd->display.mode = LCD_ENTRYLEFT | LCD_ENTRYSHIFTDECREMENT;
+
+  lcd_initController(lcd);
+}
+
+/**
+ *  @brief Initialization by instruction, whatever state the controller is in
+ *  Sets the interface, the function set, display control and entry mode of
+ *  lcd->display and clears the display.
+ */
+static void lcd_initController(struct lcd *lcd){
+  // fixed delays until the handshake is done, also when initializing again
+  lcd->pin.busyflag = false;
 
   // see page 45/46 for initialization specificatrion
   // according to datasheet, we need at least 40ms after power rises above 2.7V
   // we wait nevertheless
-  mdelay(50);
-
-  // pull both RS and R/W low to begin commands
-  gpio_set_value(_pin.rs, LCD_LOW);
-  gpio_set_value(_pin.enable, LCD_LOW);
-  if(_pin.rw != 255){
-    gpio_set_value(_pin.rw, LCD_LOW);
-  }  
+  lcd_holdBus(lcd);
+  lcd_delay(lcd, 50000);
 
   // put the lcd into 4 bit or 8 bit mode
-  if ( !(_display.function & LCD_8BITMODE)) {
+  if ( !(lcd->display.function & LCD_8BITMODE)) {
     // this is according to the hitachi HD44780 datasheet
     
     // start in 8bit mode, try to set 4 bit mode
-    lcd_write4bits(0x03);
-    mdelay(5); // wait min 4.1ms
+    lcd_write4bits(lcd, 0x03, LCD_LOW);
+    lcd_delay(lcd, 5000); // wait min 4.1ms
 
     // second try
-    lcd_write4bits(0x03);
-    mdelay(5); // wait min 4.1ms
+    lcd_write4bits(lcd, 0x03, LCD_LOW);
+    lcd_delay(lcd, 5000); // wait min 4.1ms
 
     // third go!
-    lcd_write4bits(0x03);
-    udelay(150);
+    lcd_write4bits(lcd, 0x03, LCD_LOW);
+    lcd_delay(lcd, 150);
 
     // finally, set to 4-bit interface
-    lcd_write4bits(0x02);
+    lcd_write4bits(lcd, 0x02, LCD_LOW);
+    lcd_delay(lcd, lcd->timing.command);
 
     printk(KERN_INFO "Lcd: setup data connection in 4Bit mode\n");
     
@@ -197,202 +227,1088 @@ void lcd_begin(unsigned char cols, unsigned char lines, unsigned char dotsize){
     // this is according to the hitachi HD44780 datasheet
 
     // Send function set command sequence
-    lcd_command(LCD_FUNCTIONSET | _display.function);
-    mdelay(5);  // wait more than 4.1ms
+    lcd_command(lcd, LCD_FUNCTIONSET | lcd->display.function);
+    lcd_delay(lcd, 5000);  // wait more than 4.1ms
 
     // second try
-    lcd_command(LCD_FUNCTIONSET | _display.function);
-    mdelay(5);
+    lcd_command(lcd, LCD_FUNCTIONSET | lcd->display.function);
+    lcd_delay(lcd, 5000);
 
     // third go
-    lcd_command(LCD_FUNCTIONSET | _display.function);
+    lcd_command(lcd, LCD_FUNCTIONSET | lcd->display.function);
 
     printk(KERN_INFO "Lcd: setup data connection in 8Bit mode");
   }
 
   // finally, set # lines, font size, etc.
-  lcd_command(LCD_FUNCTIONSET | _display.function);
+  lcd_command(lcd, LCD_FUNCTIONSET | lcd->display.function);
+  lcd_command(lcd, LCD_DISPLAYCONTROL | lcd->display.control);
 
-  // turn the display on with no cursor or blinking default
-  _display.control = LCD_DISPLAYON | LCD_CURSOROFF | LCD_BLINKOFF;
-  lcd_display();
-
-  // clear it off
-  lcd_clear();
+  // clear it off, the DDRAM content is unknown and only a real clear gives a known state
+  lcd_clearDisplay(lcd);
   
-  // initialize to default text direction (for romance languages)
-  _display.mode = LCD_ENTRYLEFT | LCD_ENTRYSHIFTDECREMENT;
 
   // set the entry mode
-  lcd_command(LCD_ENTRYMODESET | _display.mode);
-  
+  lcd_command(lcd, LCD_ENTRYMODESET | lcd->display.mode);
+
+  lcd_releaseBus(lcd);
+
+  // from now on wait for the busy flag instead of fixed delays, if RW is wired
+  // and the data lines read back what the controller drives
+  if (lcd->pin.rw != 255 && lcd->bus->read) {
+    lcd->pin.busyflag = lcd_checkRead(lcd);
+    if (!lcd->pin.busyflag) {
+      printk(KERN_WARNING "Lcd: the display does not read back, using fixed delays\n");
+    }
+  }
+}
+
+void lcd_getStats(struct lcd *lcd, struct lcd_stats *stats){
+  *stats = lcd->stats;
+}
+// Name of an instruction class of struct lcd_stats
+const char *lcd_getCommandName(unsigned int cmdclass){
+  static const char *names[LCD_CMD_CLASSES] = {
+    "clear", "home", "entry_mode", "display_control", "shift", "function_set", "cgram_addr", "ddram_addr"
+  };
+  return (cmdclass < LCD_CMD_CLASSES) ? names[cmdclass] : NULL;
+}
+
+/**
+ *  @brief Timing profile of a controller
+ *  @return NULL if the controller is unknown
+ */
+const struct lcd_timing *lcd_findTiming(const char *name){
+  int i;
+
+  for (i = 0; i < ARRAY_SIZE(lcd_timings); i++) {
+    if (!strcmp(lcd_timings[i].name, name)) {
+      return &lcd_timings[i];
+    }
+  }
+  return NULL;
+}
+// Enumerate the timing profiles, NULL after the last one
+const struct lcd_timing *lcd_getTimingProfile(unsigned int i){
+  return (i < ARRAY_SIZE(lcd_timings)) ? &lcd_timings[i] : NULL;
+}
+void lcd_setTiming(struct lcd *lcd, const struct lcd_timing *timing){
+  lcd->timing = *timing;
+}
+void lcd_getTiming(struct lcd *lcd, struct lcd_timing *timing){
+  *timing = lcd->timing;
+}
+// Plan the updates with the timing profile, false: rewrite the dirty cells row by row
+void lcd_setPlanner(struct lcd *lcd, bool on){
+  lcd->frame.plan = on;
 }
 
 
 /***** high level commands ******/
 
 // Control cursor position
-void lcd_setCursor(unsigned char col, unsigned char row)
+void lcd_setCursor(struct lcd *lcd, unsigned char col, unsigned char row)
 {
-  const size_t max_lines = sizeof(_cursor.row_offsets) / sizeof(*_cursor.row_offsets);
+  lcd_moveCursor(lcd, col, row);
+  lcd_setAddr(lcd, lcd->cursor.col + lcd->cursor.row_offsets[lcd->cursor.row]);
+}
+
+/**
+ *  @brief Place the cursor of the frame without touching the display
+ *  The address counter follows with the next lcd_commit() and lcd_flush().
+ */
+void lcd_moveCursor(struct lcd *lcd, unsigned char col, unsigned char row)
+{
+  const size_t max_lines = sizeof(lcd->cursor.row_offsets) / sizeof(*lcd->cursor.row_offsets);
   if ( row >= max_lines ) {
     row = max_lines - 1;    // we count rows starting w/0
   }
-  if ( row >= _cursor.row_max ) {
-    row = _cursor.row_max - 1;    // we count rows starting w/0
+  if ( row >= lcd->cursor.row_max ) {
+    row = lcd->cursor.row_max - 1;    // we count rows starting w/0
   }
 
-  _cursor.col = col;
-  _cursor.row = row;
-  
-  lcd_command(LCD_SETDDRAMADDR | (col + _cursor.row_offsets[row]));
+  lcd->cursor.col = col;
+  lcd->cursor.row = row;
 }
-unsigned char lcd_getCursorPosRow(void){
-  return _cursor.row;
+unsigned char lcd_getCursorPosRow(struct lcd *lcd){
+  return lcd->cursor.row;
 }
-unsigned char lcd_getCursorPosCol(void){
-  return _cursor.col;
+unsigned char lcd_getCursorPosCol(struct lcd *lcd){
+  return lcd->cursor.col;
+}
+unsigned char lcd_getRows(struct lcd *lcd){
+  return lcd->cursor.row_max;
+}
+unsigned char lcd_getCols(struct lcd *lcd){
+  return lcd->cursor.col_max;
+}
+
+/**
+ *  @brief Page holding the rendered frame, rows * cols cells row by row
+ *  Changes show up on the display with the next lcd_commit() and lcd_flush().
+ */
+unsigned char *lcd_getFrameBuffer(struct lcd *lcd){
+  return lcd->frame.cell;
 }
 
 
 // Turn the display on/off (quickly)
-void lcd_noDisplay() {
-  _display.control &= ~LCD_DISPLAYON;
-  lcd_command(LCD_DISPLAYCONTROL | _display.control);
+void lcd_noDisplay(struct lcd *lcd) {
+  lcd->display.control &= ~LCD_DISPLAYON;
+  lcd_command(lcd, LCD_DISPLAYCONTROL | lcd->display.control);
 }
-void lcd_display(){
-  _display.control |= LCD_DISPLAYON;
-  lcd_command(LCD_DISPLAYCONTROL | _display.control);
+void lcd_display(struct lcd *lcd){
+  lcd->display.control |= LCD_DISPLAYON;
+  lcd_command(lcd, LCD_DISPLAYCONTROL | lcd->display.control);
 }
-bool lcd_isDisplayOn(){
-  return (_display.control & LCD_DISPLAYON) ? true : false;
+bool lcd_isDisplayOn(struct lcd *lcd){
+  return (lcd->display.control & LCD_DISPLAYON) ? true : false;
 }
 
 
 // Turns the underline cursor on/off
-void lcd_noCursor() {
-  _display.control &= ~LCD_CURSORON;
-  lcd_command(LCD_DISPLAYCONTROL | _display.control);
+void lcd_noCursor(struct lcd *lcd) {
+  lcd->display.control &= ~LCD_CURSORON;
+  lcd_command(lcd, LCD_DISPLAYCONTROL | lcd->display.control);
 }
-void lcd_cursor() {
-  _display.control |= LCD_CURSORON;
-  lcd_command(LCD_DISPLAYCONTROL | _display.control);
+void lcd_cursor(struct lcd *lcd) {
+  lcd->display.control |= LCD_CURSORON;
+  lcd_command(lcd, LCD_DISPLAYCONTROL | lcd->display.control);
 }
-bool lcd_isCursorOn(){
-  return (_display.control & LCD_CURSORON) ? true : false;
+bool lcd_isCursorOn(struct lcd *lcd){
+  return (lcd->display.control & LCD_CURSORON) ? true : false;
 }
 
 
 // Turn the blinking cursor on/off
-void lcd_noBlink() {
-  _display.control &= ~LCD_BLINKON;
-  lcd_command(LCD_DISPLAYCONTROL | _display.control);
+void lcd_noBlink(struct lcd *lcd) {
+  lcd->display.control &= ~LCD_BLINKON;
+  lcd_command(lcd, LCD_DISPLAYCONTROL | lcd->display.control);
 }
-void lcd_blink() {
-  _display.control |= LCD_BLINKON;
-  lcd_command(LCD_DISPLAYCONTROL | _display.control);
+void lcd_blink(struct lcd *lcd) {
+  lcd->display.control |= LCD_BLINKON;
+  lcd_command(lcd, LCD_DISPLAYCONTROL | lcd->display.control);
 }
-bool lcd_isBlinkOn(){
-  return (_display.control & LCD_BLINKON) ? true : false;
+bool lcd_isBlinkOn(struct lcd *lcd){
+  return (lcd->display.control & LCD_BLINKON) ? true : false;
 }
 
 // This will scroll text and keeps the cursor on its column
-void lcd_autoscroll(void) {
-  _display.mode |= LCD_ENTRYSHIFTINCREMENT;
-  lcd_command(LCD_ENTRYMODESET | _display.mode);
+void lcd_autoscroll(struct lcd *lcd) {
+  lcd->display.mode |= LCD_ENTRYSHIFTINCREMENT;
+  lcd_command(lcd, LCD_ENTRYMODESET | lcd->display.mode);
 }
 // Instead of scroll text the cursor position gets increased 
-void lcd_noAutoscroll(void) {
-  _display.mode &= ~LCD_ENTRYSHIFTINCREMENT;
-  lcd_command(LCD_ENTRYMODESET | _display.mode);
+void lcd_noAutoscroll(struct lcd *lcd) {
+  lcd->display.mode &= ~LCD_ENTRYSHIFTINCREMENT;
+  lcd_command(lcd, LCD_ENTRYMODESET | lcd->display.mode);
 }
-bool lcd_isAutoscroll(void){
-  return (_display.mode & LCD_ENTRYSHIFTINCREMENT) ? true : false;
+bool lcd_isAutoscroll(struct lcd *lcd){
+  return (lcd->display.mode & LCD_ENTRYSHIFTINCREMENT) ? true : false;
 }
 
 // These commands scroll the display without changing the RAM
-void lcd_scrollDisplayLeft(void) {
-  lcd_command(LCD_CURSORSHIFT | LCD_DISPLAYMOVE | LCD_MOVELEFT);
+void lcd_scrollDisplayLeft(struct lcd *lcd) {
+  lcd_shift(lcd, LCD_DISPLAYMOVE | LCD_MOVELEFT);
 }
-void lcd_scrollDisplayRight(void) {
-  lcd_command(LCD_CURSORSHIFT | LCD_DISPLAYMOVE | LCD_MOVERIGHT);
+void lcd_scrollDisplayRight(struct lcd *lcd) {
+  lcd_shift(lcd, LCD_DISPLAYMOVE | LCD_MOVERIGHT);
 }
 
 
 // This is for text that flows Left to Right
-void lcd_leftToRight(void) {
-  _display.mode |= LCD_ENTRYLEFT;
-  lcd_command(LCD_ENTRYMODESET | _display.mode);
+void lcd_leftToRight(struct lcd *lcd) {
+  lcd->display.mode |= LCD_ENTRYLEFT;
+  lcd_command(lcd, LCD_ENTRYMODESET | lcd->display.mode);
 }
 // This is for text that flows Right to Left
-void lcd_rightToLeft(void) {
-  _display.mode &= ~LCD_ENTRYLEFT;
-  lcd_command(LCD_ENTRYMODESET | _display.mode);
+void lcd_rightToLeft(struct lcd *lcd) {
+  lcd->display.mode &= ~LCD_ENTRYLEFT;
+  lcd_command(lcd, LCD_ENTRYMODESET | lcd->display.mode);
+}
+bool lcd_isLeftToRight(struct lcd *lcd){
+  return (lcd->display.mode & LCD_ENTRYLEFT) ? true : false;
 }
-bool lcd_isLeftToRight(void){
-  return (_display.mode & LCD_ENTRYLEFT) ? true : false;
+
+// Set all display control flags (LCD_DISPLAYON, LCD_CURSORON, LCD_BLINKON) with one command
+void lcd_setControl(struct lcd *lcd, unsigned char control) {
+  lcd->display.control = control & (LCD_DISPLAYON | LCD_CURSORON | LCD_BLINKON);
+  lcd_command(lcd, LCD_DISPLAYCONTROL | lcd->display.control);
+}
+
+// Set both entry mode flags (LCD_ENTRYLEFT, LCD_ENTRYSHIFTINCREMENT) with one command
+void lcd_setEntryMode(struct lcd *lcd, unsigned char mode) {
+  lcd->display.mode = mode & (LCD_ENTRYLEFT | LCD_ENTRYSHIFTINCREMENT);
+  lcd_command(lcd, LCD_ENTRYMODESET | lcd->display.mode);
+}
+
+unsigned char lcd_getControl(struct lcd *lcd) {
+  return lcd->display.control;
+}
+unsigned char lcd_getEntryMode(struct lcd *lcd) {
+  return lcd->display.mode;
+}
+
+// Shift the display or the cursor by one (LCD_DISPLAYMOVE, LCD_MOVERIGHT)
+// A display shift moves the frame, lcd_flush() writes it unshifted from then on.
+void lcd_shift(struct lcd *lcd, unsigned char flags) {
+  if (flags & LCD_DISPLAYMOVE) {
+    lcd->frame.shift_owned = false;
+  }
+  lcd_moveDisplay(lcd, flags);
+}
+
+// Send a shift instruction and follow it in the shadow state
+static void lcd_moveDisplay(struct lcd *lcd, unsigned char flags) {
+  unsigned char width = lcd_lineWidth(lcd);
+
+  flags &= LCD_DISPLAYMOVE | LCD_MOVERIGHT;
+  lcd_command(lcd, LCD_CURSORSHIFT | flags);
+  if (!(flags & LCD_DISPLAYMOVE)) {
+    lcd->frame.addr_valid = false;     // a cursor move changes the address counter
+  }
+  else if (flags & LCD_MOVERIGHT) {
+    lcd->frame.shift = (lcd->frame.shift + width - 1) % width;
+  }
+  else {
+    lcd->frame.shift = (lcd->frame.shift + 1) % width;
+  }
 }
 
 // Fill the first 8 CGRAM locations with custom characters
-void lcd_createChar(unsigned char location, unsigned char charmap[]) {
-  int i;
+// The slot is taken away from the glyph cache, the DDRAM address is restored.
+void lcd_createChar(struct lcd *lcd, unsigned char location, unsigned char charmap[]) {
+  unsigned char owner, addr = lcd->frame.addr;
+  bool addr_valid = lcd->frame.addr_valid;
+
   location &= 0x7; // we only have 8 locations 0-7
-  lcd_command(LCD_SETCGRAMADDR | (location << 3));
-  for (i=0; i<8; i++) {
-    lcd_write(charmap[i]);
+  owner = lcd->glyph.owner[location];
+  if (owner && owner != LCD_SLOT_RAW) {
+    lcd->glyph.slot[owner - 1] = 0;
   }
+  lcd->glyph.owner[location] = LCD_SLOT_RAW;
+
+  if (lcd->glyph.cgram_valid[location] && !memcmp(lcd->glyph.cgram[location], charmap, 8)) {
+    return;
+  }
+  lcd_holdBus(lcd);
+  lcd_writeCGRAM(lcd, location, charmap);
+  if (addr_valid) {
+    lcd_setAddr(lcd, addr);
+  }
+  lcd_releaseBus(lcd);
 }
 
-void lcd_clear(void){
-  lcd_command(LCD_CLEARDISPLAY);   // clear display, set cursor to zero
-  mdelay(2);                       // this command takes a long time!
+/**
+ *  @brief Register a glyph for lcd_renderGlyph()
+ *  Glyphs are loaded into a CGRAM slot by lcd_flush() while they are on the
+ *  display. If more than the free slots are visible, the rest show fallback.
+ *  @return 0 on success, -EINVAL if the glyph number is out of range
+ */
+int lcd_registerGlyph(struct lcd *lcd, unsigned int glyph, const unsigned char bitmap[8], unsigned char fallback){
+  if (glyph >= LCD_USER_GLYPHS) {
+    return -EINVAL;
+  }
+  memcpy(lcd->glyph.bitmap[glyph], bitmap, 8);
+  lcd->glyph.fallback[glyph] = fallback;
+  lcd->glyph.defined[glyph] = true;
+  return 0;
 }
 
-void lcd_home(){
-  lcd_command(LCD_RETURNHOME);     // set the cursor to zero
-  mdelay(2);                       // this command takes a long time!
+// Put a registered glyph at the cursor of the frame
+void lcd_renderGlyph(struct lcd *lcd, unsigned int glyph){
+  if (glyph >= LCD_GLYPHS || !lcd->glyph.defined[glyph]) {
+    lcd_renderChar(lcd, ' ', 0);
+    return;
+  }
+  lcd_renderChar(lcd, lcd->glyph.fallback[glyph], glyph + 1);
 }
 
-void lcd_print(const char *str){
-  lcd_printn((char *)str, strlen(str));
+/**
+ *  @brief Blank the display and stop the marquee
+ *  Goes through lcd_flush() like the '\e' escape, which sends a display clear
+ *  only if that is cheaper than writing spaces over the non-blank cells.
+ */
+void lcd_clear(struct lcd *lcd){
+  char esc = '\e';
+
+  lcd->marquee.active = false;
+  lcd_render(lcd, &esc, 1);
+  lcd_commit(lcd);
+  lcd_flush(lcd);
+}
+
+void lcd_home(struct lcd *lcd){
+  lcd_sendWait(lcd, LCD_RETURNHOME, LCD_LOW, lcd->timing.home);   // set the cursor to zero
+  lcd->frame.addr = 0;
+  lcd->frame.addr_valid = true;
+  lcd->frame.shift = 0;
+  lcd->cursor.row = 0;
+  lcd->cursor.col = 0;
 }
-void lcd_printn(char *str, size_t n){
-  int i = 0;
+
+void lcd_print(struct lcd *lcd, const char *str){
+  lcd_printn(lcd, (char *)str, strlen(str));
+}
+// Write UTF-8 text at once, glyphs of the character set appear as their fallback
+void lcd_printn(struct lcd *lcd, char *str, size_t n){
+  struct lcd_utf8 utf8 = { 0 };
+  u16 entry[LCD_UTF8_OUT];
+  int i = 0, j, k;
+
+  lcd_holdBus(lcd);
   while( i < n && str[i] != '\0' ){
-    lcd_write(str[i]);
+    k = lcd_decodeUtf8(lcd->charset, &utf8, str[i], entry);
+    for (j = 0; j < k; j++) {
+      lcd_write(lcd, entry[j] & 0xFF);
+    }
     i++;
   }
+  k = lcd_breakUtf8(&utf8, entry);
+  for (j = 0; j < k; j++) {
+    lcd_write(lcd, entry[j] & 0xFF);
+  }
+  lcd_releaseBus(lcd);
+}
+
+void lcd_update(struct lcd *lcd, char *str){
+  lcd_updaten(lcd, str, strlen(str));
+}
+
+void lcd_updaten(struct lcd *lcd, char *str, size_t n){
+  lcd_render(lcd, str, n);
+  lcd_commit(lcd);
+  lcd_flush(lcd);
+}
+
+/**
+ *  @brief Hand the rendered frame over to lcd_flush()
+ *  This only copies memory, so rendering may go on while the display is flushed.
+ *  @return true if the committed frame shows other characters than the last one
+ */
+bool lcd_commit(struct lcd *lcd){
+  struct lcd_marquee *marquee = &lcd->marquee;
+  bool changed = false;
+  unsigned char c, g;
+  int i, first = LCD_FRAME_SIZE, last = LCD_FRAME_SIZE;
+
+  // the marquee row shows the part of the text the display shift has reached
+  lcd->next_marquee = *marquee;
+  if (marquee->active) {
+    first = marquee->row * lcd->cursor.col_max;
+    last = first + lcd->cursor.col_max;
+  }
+
+  for (i = 0; i < LCD_FRAME_SIZE; i++) {
+    c = lcd->frame.cell[i];
+    g = lcd->frame.glyph[i];
+    // a glyph only counts while its cell still holds the fallback, mmap() writers don't know glyphs
+    g = (g && c == lcd->glyph.fallback[g - 1]) ? g : 0;
+    if (i >= first && i < last) {
+      c = marquee->text[(marquee->step + i - first) % marquee->period];
+      g = 0;
+    }
+    changed |= lcd->frame.next[i] != c || lcd->frame.next_glyph[i] != g;
+    lcd->frame.next[i] = c;
+    lcd->frame.next_glyph[i] = g;
+  }
+  lcd->frame.next_row = lcd->cursor.row;
+  lcd->frame.next_col = lcd->cursor.col;
+  lcd->frame.next_clear |= lcd->frame.clear;
+  lcd->frame.clear = false;
+  return changed;
+}
+
+/**
+ *  @brief Bring the display in line with the committed frame
+ *  Only cells that differ from the DDRAM shadow are sent. The planner weighs
+ *  the ways to get there with the timing profile, see lcd_flushPlanned(). A
+ *  marquee moves the view with the display shift, the other rows are written
+ *  where the shifted view shows them.
+ */
+void lcd_flush(struct lcd *lcd){
+  unsigned long bytes = lcd->stats.bytes;
+  bool planned;
+  u64 start = trace_lcd_flush_end_enabled() ? ktime_get_ns() : 0;
+
+  // autoscroll shifts the display with every character, only the plain rewrite keeps up with it
+  planned = lcd->frame.plan && !(lcd->display.mode & LCD_ENTRYSHIFTINCREMENT);
+
+  trace_lcd_flush_start(lcd, lcd->frame.next_clear);
+  lcd_holdBus(lcd);
+
+  if (lcd->frame.next_clear && !planned) {
+    lcd_clearDisplay(lcd);
+  }
+
+  lcd_loadGlyphs(lcd);
+
+  if (planned) {
+    lcd_flushPlanned(lcd, lcd->frame.next_clear);
+  }
+  else {
+    lcd_flushCells(lcd);
+  }
+  lcd->frame.next_clear = false;
+  lcd_releaseBus(lcd);
+
+  if (start) {
+    trace_lcd_flush_end(lcd, lcd->stats.bytes - bytes, ktime_get_ns() - start);
+  }
+}
+
+// Character code a cell of the committed frame is written as
+static unsigned char lcd_nextChar(struct lcd *lcd, int i){
+  unsigned char g = lcd->frame.next_glyph[i];
+
+  if (g && lcd->glyph.slot[g - 1]) {
+    return lcd->glyph.slot[g - 1] - 1;   // character code of the CGRAM slot
+  }
+  return lcd->frame.next[i];
+}
+
+/**
+ *  @brief Rewrite the dirty cells row by row
+ *  The address is only set if the next dirty cell is not where the address
+ *  counter already points.
+ */
+static void lcd_flushCells(struct lcd *lcd){
+  unsigned char row, col, addr, c, view = 0;
+
+  // a shift left by lcd_shift() is kept, one left by a stopped marquee is undone
+  if (lcd->next_marquee.active) {
+    view = lcd->next_marquee.step % lcd_lineWidth(lcd);
+  }
+  if (lcd->next_marquee.active || lcd->frame.shift_owned) {
+    lcd_shiftTo(lcd, view);
+    lcd->frame.shift_owned = lcd->next_marquee.active;
+  }
+
+  for (row = 0; row < lcd->cursor.row_max; row++) {
+    if (lcd->next_marquee.active && row == lcd->next_marquee.row) {
+      lcd_flushMarquee(lcd, view);
+      continue;
+    }
+    for (col = 0; col < lcd->cursor.col_max; col++) {
+      c = lcd_nextChar(lcd, row * lcd->cursor.col_max + col);
+      addr = lcd_cellAddr(lcd, row, col, view);
+      if (lcd->frame.ddram[addr] == c) {
+	continue;
+      }
+      if (!lcd->frame.addr_valid || lcd->frame.addr != addr) {
+	lcd_setAddr(lcd, addr);
+      }
+      lcd_putc(lcd, c);
+    }
+  }
+  lcd_flushCursor(lcd, view);
+}
+
+/**
+ *  @brief Write the DDRAM line of the marquee row
+ *  The whole line holds text, the cells outside of the view are those the next
+ *  steps shift in. Once loaded, a step only writes the cell that leaves the
+ *  view if the text is longer than the line.
+ */
+static void lcd_flushMarquee(struct lcd *lcd, unsigned char view){
+  struct lcd_marquee *marquee = &lcd->next_marquee;
+  unsigned char width = lcd_lineWidth(lcd);
+  unsigned char base = lcd->cursor.row_offsets[marquee->row];
+  unsigned char i, addr, c;
+
+  for (i = 0; i < width; i++) {
+    c = marquee->text[(marquee->step + i) % marquee->period];
+    addr = base + (view + i) % width;
+    if (lcd->frame.ddram[addr] == c) {
+      continue;
+    }
+    if (!lcd->frame.addr_valid || lcd->frame.addr != addr) {
+      lcd_setAddr(lcd, addr);
+    }
+    lcd_putc(lcd, c);
+  }
+}
+
+// Leave the address counter at the logical cursor position
+static void lcd_flushCursor(struct lcd *lcd, unsigned char view){
+  unsigned char addr = lcd_cellAddr(lcd, lcd->frame.next_row, lcd->frame.next_col, view);
+
+  lcd->frame.next_addr = addr;
+  if (!lcd->frame.addr_valid || lcd->frame.addr != addr) {
+    lcd_setAddr(lcd, addr);
+  }
+}
+
+/**
+ *  @brief Send the committed frame the cheapest way the planner finds
+ *  Candidates are the current view, views up to LCD_PLAN_SHIFTS display shifts
+ *  away, which follow content that moved sideways, and a display clear
+ *  followed by the non-blank cells. Each is scored in bus time with the
+ *  timing profile, see lcd_planWalk(). The view can only be moved while the
+ *  shift is not the marquee's or one left by lcd_shift().
+ *  @param reset the frame starts with a display clear ('\e'), which is only
+ *  sent if it is cheaper than blanking the cells that are not blank
+ */
+static void lcd_flushPlanned(struct lcd *lcd, bool reset){
+  struct lcd_marquee *marquee = &lcd->next_marquee;
+  unsigned char width = lcd_lineWidth(lcd);
+  unsigned char shift = lcd->frame.shift, view = 0, v;
+  unsigned int command = lcd_byteCost(lcd, lcd->timing.command);
+  unsigned long cost, best;
+  bool free, clear = false;
+  int k;
+
+  // after a clear the frame is unshifted, any view shows it the same way
+  free = !marquee->active && (reset || lcd->frame.shift_owned || shift == 0);
+  if (marquee->active) {
+    view = marquee->step % width;
+  }
+  else if (free) {
+    view = shift;
+  }
+
+  lcd_planTarget(lcd, view);
+  best = lcd_shiftDistance(lcd, shift, view) * command + lcd_planWalk(lcd, view, false, false);
+
+  for (k = -LCD_PLAN_SHIFTS; free && k <= LCD_PLAN_SHIFTS; k++) {
+    v = (shift + width + k) % width;
+    if (k == 0) {
+      continue;
+    }
+    lcd_planTarget(lcd, v);
+    cost = (k < 0 ? -k : k) * command + lcd_planWalk(lcd, v, false, false);
+    if (cost < best) {
+      best = cost;
+      view = v;
+    }
+  }
+
+  if (marquee->active || free) {
+    v = marquee->active ? view : 0;
+    lcd_planTarget(lcd, v);
+    cost = lcd_byteCost(lcd, lcd->timing.clear) + lcd_shiftDistance(lcd, 0, v) * command +
+      lcd_planWalk(lcd, v, true, false);
+    if (!(lcd->display.mode & LCD_ENTRYLEFT)) {
+      cost += command;                 // the entry mode is restored, see lcd_clearDisplay()
+    }
+    if (cost < best) {
+      view = v;
+      clear = true;
+    }
+  }
+
+  if (clear) {
+    lcd_clearDisplay(lcd);
+  }
+  if (marquee->active || free) {
+    lcd_shiftTo(lcd, view);
+    lcd->frame.shift_owned = true;
+  }
+  lcd_planTarget(lcd, view);
+  lcd_planWalk(lcd, view, false, true);
+}
+
+// Fill the plan with the committed frame as the view shows it
+static void lcd_planTarget(struct lcd *lcd, unsigned char view){
+  struct lcd_plan *plan = &lcd->plan;
+  struct lcd_marquee *marquee = &lcd->next_marquee;
+  unsigned char width = lcd_lineWidth(lcd);
+  unsigned char row, col, addr, base;
+
+  memset(plan->used, 0, sizeof(plan->used));
+  for (row = 0; row < lcd->cursor.row_max; row++) {
+    if (marquee->active && row == marquee->row) {
+      continue;
+    }
+    for (col = 0; col < lcd->cursor.col_max; col++) {
+      addr = lcd_cellAddr(lcd, row, col, view);
+      plan->want[addr] = lcd_nextChar(lcd, row * lcd->cursor.col_max + col);
+      plan->used[addr] = true;
+    }
+  }
+
+  // the whole line of the marquee holds text, see lcd_flushMarquee()
+  if (marquee->active) {
+    base = lcd->cursor.row_offsets[marquee->row];
+    for (col = 0; col < width; col++) {
+      addr = base + (view + col) % width;
+      plan->want[addr] = marquee->text[(marquee->step + col) % marquee->period];
+      plan->used[addr] = true;
+    }
+  }
+}
+
+/**
+ *  @brief Bus time to bring the DDRAM to the plan, optionally send it
+ *  The cells are visited in the order the address counter runs through them,
+ *  so a dirty run needs no address where a DDRAM line goes on in another row,
+ *  like row 0 into row 2 of a 20x4 display. A gap of clean or hidden cells is
+ *  written over if that is cheaper than setting the address.
+ *  @param blank cost after a display clear, the DDRAM is taken as blank
+ *  @param send false: only compute the cost
+ *  @return bus time in us, including the address of the cursor
+ */
+static unsigned long lcd_planWalk(struct lcd *lcd, unsigned char view, bool blank, bool send){
+  struct lcd_plan *plan = &lcd->plan;
+  unsigned int data = lcd_byteCost(lcd, lcd->timing.data);
+  unsigned int command = lcd_byteCost(lcd, lcd->timing.command);
+  unsigned long cost = 0;
+  unsigned char addr, old;
+  int i, gap, at = -1;     // position of the address counter, -1: unknown
+
+  if (blank) {
+    at = lcd_walkIndex(lcd, 0x00);
+  }
+  else if (lcd->frame.addr_valid) {
+    at = lcd_walkIndex(lcd, lcd->frame.addr);
+  }
+
+  for (i = 0; i < LCD_DDRAM_CELLS; i++) {
+    addr = lcd_walkAddr(lcd, i);
+    old = blank ? ' ' : lcd->frame.ddram[addr];
+    if (!plan->used[addr] || plan->want[addr] == old) {
+      continue;
+    }
+    gap = (at >= 0 && at <= i) ? i - at : -1;
+    if (gap > 0 && gap * data < command) {
+      // the cells in between are written again with what they hold
+      cost += gap * data;
+      for (; send && at < i; at++) {
+	lcd_putc(lcd, lcd->frame.ddram[lcd_walkAddr(lcd, at)]);
+      }
+    }
+    else if (gap != 0) {
+      cost += command;
+      if (send) {
+	lcd_setAddr(lcd, addr);
+      }
+    }
+    cost += data;
+    if (send) {
+      lcd_putc(lcd, plan->want[addr]);
+    }
+    at = (i + 1) % LCD_DDRAM_CELLS;
+  }
+
+  addr = lcd_cellAddr(lcd, lcd->frame.next_row, lcd->frame.next_col, view);
+  if (send) {
+    lcd_flushCursor(lcd, view);
+  }
+  else if (at < 0 || lcd_walkAddr(lcd, at) != addr) {
+    cost += command;
+  }
+  return cost;
+}
+
+// Bus time of one byte in us: one or two nibbles with 1us setup each, then the execution
+static unsigned int lcd_byteCost(struct lcd *lcd, unsigned int us){
+  unsigned int nibbles = (lcd->display.function & LCD_8BITMODE) ? 1 : 2;
+  unsigned int wire;
+
+  // on a serial bus both enable edges of a nibble are a byte, the execution overlaps the next one
+  if (lcd->bus->wire_bits && lcd->link.khz) {
+    wire = lcd->bus->wire_bits * 1000 / lcd->link.khz;
+    return nibbles * 2 * wire + ((us > wire) ? us - wire : 0);
+  }
+  return us + nibbles * (1 + lcd->timing.pulse);
+}
+
+// DDRAM address at position i of the order the address counter runs through
+static unsigned char lcd_walkAddr(struct lcd *lcd, int i){
+  if (!(lcd->display.mode & LCD_ENTRYLEFT)) {
+    i = LCD_DDRAM_CELLS - 1 - i;
+  }
+  if ((lcd->display.function & LCD_2LINE) && i >= LCD_DDRAM_CELLS / 2) {
+    return 0x40 + i - LCD_DDRAM_CELLS / 2;
+  }
+  return i;
 }
 
-void lcd_update(char *str){
-  lcd_updaten(str, strlen(str));
+// Position of a DDRAM address in that order, -1 for an address without a cell
+static int lcd_walkIndex(struct lcd *lcd, unsigned char addr){
+  int i = addr;
+
+  if (lcd->display.function & LCD_2LINE) {
+    if ((addr & 0x3F) >= LCD_DDRAM_CELLS / 2) {
+      return -1;
+    }
+    i = (addr & 0x40) ? LCD_DDRAM_CELLS / 2 + (addr & 0x3F) : addr;
+  }
+  else if (addr >= LCD_DDRAM_CELLS) {
+    return -1;
+  }
+  return (lcd->display.mode & LCD_ENTRYLEFT) ? i : LCD_DDRAM_CELLS - 1 - i;
+}
+
+/**
+ *  @brief Scroll a row with the display shift
+ *  The text is loaded into the DDRAM line of the row, every lcd_stepMarquee()
+ *  then moves it by one column. The shift moves all lines, so a marquee needs
+ *  a display where every row has a line of its own (1 or 2 rows). The other
+ *  rows are rewritten at the shifted position as needed.
+ *  @param n length of the UTF-8 text, translated by the character set like lcd_render(), 0 stops the marquee
+ *  @return 0 on success, -EINVAL for a bad row, -EOPNOTSUPP for 4 row displays
+ */
+int lcd_setMarquee(struct lcd *lcd, unsigned char row, const char *text, size_t n){
+  struct lcd_marquee *marquee = &lcd->marquee;
+  unsigned char width = lcd_lineWidth(lcd);
+  struct lcd_utf8 utf8 = { 0 };
+  u16 entry[LCD_UTF8_OUT + 1];
+  size_t i, len = 0;
+  int j, k;
+
+  if (n == 0) {
+    marquee->active = false;
+    return 0;
+  }
+  if (row >= lcd->cursor.row_max) {
+    return -EINVAL;
+  }
+  if (lcd->cursor.row_max > 2 || lcd->cursor.col_max >= width) {
+    return -EOPNOTSUPP;
+  }
+
+  // translated like lcd_render() does, glyphs scroll as their fallback character
+  for (i = 0; i <= n && len < LCD_MARQUEE_MAX; i++) {
+    if (i == n) {
+      k = lcd_breakUtf8(&utf8, entry);
+    }
+    else if ((unsigned char)text[i] < ' ') {
+      k = lcd_breakUtf8(&utf8, entry);
+      entry[k++] = ' ';
+    }
+    else {
+      k = lcd_decodeUtf8(lcd->charset, &utf8, text[i], entry);
+    }
+    for (j = 0; j < k && len < LCD_MARQUEE_MAX; j++) {
+      marquee->text[len++] = entry[j] & 0xFF;
+    }
+  }
+  // a text that fits into the line is padded to it, the line is then written only once
+  marquee->period = max(len + LCD_MARQUEE_GAP, (size_t)width);
+  memset(marquee->text + len, ' ', marquee->period - len);
+  marquee->row = row;
+  marquee->step = 0;
+  marquee->active = true;
+  return 0;
+}
+
+// Move the marquee by one column with the next flush
+bool lcd_stepMarquee(struct lcd *lcd){
+  if (lcd->marquee.active) {
+    lcd->marquee.step++;
+  }
+  return lcd->marquee.active;
+}
+
+// Row and text of the running marquee, false if there is none
+bool lcd_getMarquee(struct lcd *lcd, unsigned char *row, char *text, size_t size){
+  struct lcd_marquee *marquee = &lcd->marquee;
+  size_t n;
+
+  if (!marquee->active || size == 0) {
+    return false;
+  }
+  // the text without the padding
+  for (n = marquee->period; n > 0 && marquee->text[n - 1] == ' '; n--);
+  n = min(n, size - 1);
+  memcpy(text, marquee->text, n);
+  text[n] = '\0';
+  *row = marquee->row;
+  return true;
+}
+
+/**
+ *  @brief Give every glyph of the committed frame a CGRAM slot
+ *  Slots of glyphs that are not visible are reused, least recently used first.
+ *  A slot is only written if the shadow copy differs from the bitmap.
+ */
+static void lcd_loadGlyphs(struct lcd *lcd){
+  bool visible[LCD_GLYPHS] = { false };
+  bool any = false;
+  int i, slot, n = lcd->cursor.row_max * lcd->cursor.col_max;
+  unsigned char old;
+
+  for (i = 0; i < n; i++) {
+    if (lcd->frame.next_glyph[i]) {
+      visible[lcd->frame.next_glyph[i] - 1] = true;
+      any = true;
+    }
+  }
+  if (!any) {
+    return;
+  }
+  lcd->glyph.clock++;
+
+  // the visible glyphs that are loaded keep their slots
+  for (i = 0; i < LCD_GLYPHS; i++) {
+    if (visible[i] && lcd->glyph.slot[i]) {
+      lcd->glyph.used[lcd->glyph.slot[i] - 1] = lcd->glyph.clock;
+    }
+  }
+
+  for (i = 0; i < LCD_GLYPHS; i++) {
+    if (!visible[i]) {
+      continue;
+    }
+    if (!lcd->glyph.slot[i]) {
+      slot = lcd_pickSlot(lcd, visible);
+      if (slot < 0) {
+	continue;                          // all slots in use, the fallback is shown
+      }
+      old = lcd->glyph.owner[slot];
+      if (old) {
+	lcd->glyph.slot[old - 1] = 0;
+      }
+      lcd->glyph.owner[slot] = i + 1;
+      lcd->glyph.slot[i] = slot + 1;
+      lcd->glyph.used[slot] = lcd->glyph.clock;
+    }
+    slot = lcd->glyph.slot[i] - 1;
+    if (!lcd->glyph.cgram_valid[slot] || memcmp(lcd->glyph.cgram[slot], lcd->glyph.bitmap[i], 8)) {
+      lcd_writeCGRAM(lcd, slot, lcd->glyph.bitmap[i]);
+    }
+  }
 }
 
-void lcd_updaten(char *str, size_t n){
+// Free slot or the least recently used slot without a visible glyph, -1 if there is none
+static int lcd_pickSlot(struct lcd *lcd, const bool *visible){
+  int i, best = -1;
+  unsigned char owner;
+
+  for (i = 0; i < LCD_CGRAM_SLOTS; i++) {
+    owner = lcd->glyph.owner[i];
+    if (owner == 0) {
+      return i;
+    }
+    if (owner == LCD_SLOT_RAW || visible[owner - 1]) {
+      continue;
+    }
+    if (best < 0 || lcd->glyph.used[i] < lcd->glyph.used[best]) {
+      best = i;
+    }
+  }
+  return best;
+}
+
+// Write one CGRAM slot, the address counter is left in CGRAM
+static void lcd_writeCGRAM(struct lcd *lcd, unsigned char slot, const unsigned char bitmap[8]){
+  int i;
+
+  lcd_command(lcd, LCD_SETCGRAMADDR | (slot << 3));
+  for (i=0; i<8; i++) {
+    lcd_send(lcd, bitmap[i], LCD_HIGH);
+  }
+  memcpy(lcd->glyph.cgram[slot], bitmap, 8);
+  lcd->glyph.cgram_valid[slot] = true;
+  lcd->frame.addr_valid = false;       // address counter now points into CGRAM
+}
+
+/**
+ *  @brief Read the controller back and rewrite what differs from the shadow copy
+ *  After a glitch on the lines only the cells and CGRAM slots that changed
+ *  are written again, instead of a new initialization and a full redraw. All
+ *  DDRAM cells are read, the hidden ones too, a display shift brings them in
+ *  later. Function set, display control and entry mode cannot be read and
+ *  are sent again. Neither can the display shift: if anything differed, a
+ *  return home and the shift instructions put it where the shadow has it.
+ *
+ *  A controller reset by a brown-out is in 8 bit mode, a 4 bit interface is
+ *  out of step with it. That is found by an address that does not read back
+ *  as set, the controller is then initialized again and the committed frame
+ *  redrawn. On an 8 bit interface the settings sent again, the cell walk and
+ *  the return home cover the reset.
+ *  @return number of differences found, LCD_DDRAM_CELLS after a new
+ *  initialization, -EOPNOTSUPP if RW is not wired or the bus cannot read,
+ *  -EIO if the busy flag was given up on
+ */
+int lcd_resync(struct lcd *lcd){
+  bool bad[LCD_DDRAM_SIZE] = { false };
+  bool reset, cursor_valid = lcd->frame.addr_valid;
+  unsigned char bitmap[8], addr, value, cursor = lcd->frame.addr, shift = lcd->frame.shift;
+  int i, slot, repairs = 0;
+
+  if (lcd->pin.rw == 255 || !lcd->bus->read) {
+    return -EOPNOTSUPP;
+  }
+  if (!lcd->pin.busyflag) {
+    return -EIO;
+  }
+  lcd_holdBus(lcd);
+
+  // the address counter only points into DDRAM after a write or an address set
+  value = lcd->bus->read(lcd, false) & ~LCD_BUSYFLAG;
+  if (lcd->frame.addr_valid && value != lcd->frame.addr) {
+    repairs++;
+  }
+
+  reset = !lcd_probeAddr(lcd);
+  if (reset) {
+    printk(KERN_WARNING "Lcd: the controller does not answer as set up, initializing it again\n");
+    lcd_initController(lcd);
+    repairs = LCD_DDRAM_CELLS;
+  }
+  else {
+    lcd_command(lcd, LCD_FUNCTIONSET | lcd->display.function);
+    lcd_command(lcd, LCD_DISPLAYCONTROL | lcd->display.control);
+    // autoscroll would move the display with every repaired cell
+    lcd_command(lcd, LCD_ENTRYMODESET | (lcd->display.mode & ~LCD_ENTRYSHIFTINCREMENT));
+  }
+
+  for (slot = 0; slot < LCD_CGRAM_SLOTS; slot++) {
+    if (!lcd->glyph.cgram_valid[slot]) {
+      continue;
+    }
+    // only the lower 5 bits of a row exist
+    i = 0;
+    if (!reset) {
+      lcd_command(lcd, LCD_SETCGRAMADDR | (slot << 3));
+      while (i < 8 && !((lcd_readData(lcd) ^ lcd->glyph.cgram[slot][i]) & 0x1F)) {
+	i++;
+      }
+    }
+    if (i < 8) {
+      memcpy(bitmap, lcd->glyph.cgram[slot], 8);
+      lcd_writeCGRAM(lcd, slot, bitmap);
+      repairs += !reset;
+    }
+  }
+
+  if (reset) {
+    // the cleared display is written like after a clear, at the shift it had
+    lcd_shiftTo(lcd, shift);
+    lcd_flush(lcd);
+    lcd_releaseBus(lcd);
+    goto done;
+  }
+
+  // a read moves the address counter like a write, without autoscroll
+  lcd_setAddr(lcd, 0);
+  for (i = 0; i < LCD_DDRAM_CELLS; i++) {
+    addr = lcd->frame.addr;
+    if (lcd_readData(lcd) != lcd->frame.ddram[addr]) {
+      bad[addr] = true;
+      repairs++;
+    }
+    lcd_advanceAddr(lcd);
+  }
+  if (!lcd->pin.busyflag) {
+    // what was read is not the content, nothing is written but the entry mode
+    lcd_command(lcd, LCD_ENTRYMODESET | lcd->display.mode);
+    lcd_releaseBus(lcd);
+    lcd->stats.resyncs++;
+    return -EIO;
+  }
+  for (addr = 0; addr < LCD_DDRAM_SIZE; addr++) {
+    if (!bad[addr]) {
+      continue;
+    }
+    if (lcd->frame.addr != addr) {
+      lcd_setAddr(lcd, addr);
+    }
+    lcd_send(lcd, lcd->frame.ddram[addr], LCD_HIGH);
+    lcd_advanceAddr(lcd);
+  }
+  lcd_command(lcd, LCD_ENTRYMODESET | lcd->display.mode);
+
+  // whatever changed the cells may have moved the display as well
+  if (repairs && shift) {
+    lcd_sendWait(lcd, LCD_RETURNHOME, LCD_LOW, lcd->timing.home);
+    lcd->frame.addr = 0;
+    lcd->frame.addr_valid = true;
+    lcd->frame.shift = 0;
+    lcd_shiftTo(lcd, shift);
+  }
+  // the address counter is where the cursor is shown
+  if (cursor_valid && lcd->frame.addr != cursor) {
+    lcd_setAddr(lcd, cursor);
+  }
+  lcd_releaseBus(lcd);
+
+done:
+  lcd->stats.resyncs++;
+  lcd->stats.repairs += repairs;
+  return repairs;
+}
+
+// The address counter reads back what was set, unless the interface is out of step with the controller
+static bool lcd_probeAddr(struct lcd *lcd){
+  // valid in both line modes, different nibbles
+  const unsigned char addr = 0x4A;
+
+  if (!(lcd->display.function & LCD_8BITMODE)) {
+    // a controller in 8 bit mode executes each nibble, give both the time
+    lcd_write4bits(lcd, (LCD_SETDDRAMADDR | addr) >> 4, LCD_LOW);
+    lcd_delay(lcd, lcd->timing.command);
+    lcd_write4bits(lcd, LCD_SETDDRAMADDR | addr, LCD_LOW);
+    lcd_delay(lcd, lcd->timing.command);
+    lcd->frame.addr = addr;
+    lcd->frame.addr_valid = true;
+  }
+  else {
+    lcd_setAddr(lcd, addr);
+  }
+  return (lcd->bus->read(lcd, false) & ~LCD_BUSYFLAG) == addr;
+}
+
+/**
+ *  @brief Copy the committed frame into buf, one '\n' terminated line per row
+ *  This is what the display shows once the frame is flushed, glyphs appear as
+ *  their fallback character.
+ *  @return number of characters written, without the terminating '\0'
+ */
+size_t lcd_getFrame(struct lcd *lcd, char *buf, size_t size){
+  size_t len = 0;
+  unsigned char row, col;
+
+  if (size == 0) {
+    return 0;
+  }
+  for (row = 0; row < lcd->cursor.row_max; row++) {
+    for (col = 0; col < lcd->cursor.col_max && len < size - 1; col++) {
+      buf[len++] = lcd->frame.next[row * lcd->cursor.col_max + col];
+    }
+    if (len < size - 1) {
+      buf[len++] = '\n';
+    }
+  }
+  buf[len] = '\0';
+  return len;
+}
+
+/**
+ *  @brief Render a message into the frame, interpreting the escape characters
+ *  The text is UTF-8 and translated by the character set of the display, a
+ *  sequence may continue with the next call. The display is not touched, see
+ *  lcd_commit() and lcd_flush().
+ */
+void lcd_render(struct lcd *lcd, char *str, size_t n){
+  u16 entry[LCD_UTF8_OUT];
 
   // iterate over the entire message
   while (n > 0) {
     // treat escape sequences separately
-    if (*str <= 31) {
+    if ((unsigned char)*str <= 31) {
+      lcd_renderEntries(lcd, entry, lcd_breakUtf8(&lcd->utf8, entry));
 
       switch(*str) {
       case '\e':
-	lcd_clear();
-	_cursor.row = 0;
-	_cursor.col = 0;
+	memset(lcd->frame.cell, ' ', LCD_FRAME_SIZE);
+	memset(lcd->frame.glyph, 0, LCD_FRAME_SIZE);
+	lcd->frame.clear = true;
+	lcd->cursor.row = 0;
+	lcd->cursor.col = 0;
 	break;
       case '\0':
-	_cursor.row = 0;
-	_cursor.col = 0;
-	lcd_setCursor(_cursor.col, _cursor.row);
+	lcd->cursor.row = 0;
+	lcd->cursor.col = 0;
 	break;
       case '\n':
-	_cursor.col = 0;
-	_cursor.row++;
-	if(_cursor.row >= _cursor.row_max){
-	  _cursor.row = 0;
+	lcd->cursor.col = 0;
+	lcd->cursor.row++;
+	if(lcd->cursor.row >= lcd->cursor.row_max){
+	  lcd->cursor.row = 0;
 	}
-	lcd_setCursor(_cursor.col, _cursor.row);
 	break;
       default: break;
       }
@@ -403,86 +1319,362 @@ void lcd_updaten(char *str, size_t n){
     }
 
     // write one character
-    lcd_write(*str);
+    lcd_renderEntries(lcd, entry, lcd_decodeUtf8(lcd->charset, &lcd->utf8, *str, entry));
     str++;
     n--;
-    
-    // jump to next row if line ends
-    if (_cursor.col >= _cursor.col_max) {
-      _cursor.col = 0;
-      _cursor.row++;
-      if(_cursor.row >= _cursor.row_max){
-	_cursor.row = 0;
-      }    
-      lcd_setCursor(_cursor.col, _cursor.row);
-    }
   }
 }
 
-static void lcd_setRowOffsets(int row0, int row1, int row2, int row3){
-  _cursor.row_offsets[0] = row0;
-  _cursor.row_offsets[1] = row1;
-  _cursor.row_offsets[2] = row2;
-  _cursor.row_offsets[3] = row3;  
+// Put characters of the character set tables at the cursor
+static void lcd_renderEntries(struct lcd *lcd, const u16 *entry, int n){
+  int i;
+
+  for (i = 0; i < n; i++) {
+    lcd_renderChar(lcd, entry[i] & 0xFF, entry[i] >> 8);
+  }
+}
+
+// Use a character set and register its glyphs after those of lcd_registerGlyph()
+static void lcd_setCharset(struct lcd *lcd, const struct lcd_charset *charset){
+  unsigned int i, glyph;
+
+  lcd->charset = charset;
+  for (i = 0; charset && i < charset->glyphs; i++) {
+    glyph = (charset->glyph[i].entry >> 8) - 1;
+    memcpy(lcd->glyph.bitmap[glyph], charset->glyph[i].bitmap, 8);
+    lcd->glyph.fallback[glyph] = charset->glyph[i].entry & 0xFF;
+    lcd->glyph.defined[glyph] = true;
+  }
+}
+
+/**
+ *  @brief Render characters into the frame as they are
+ *  Unlike lcd_render() there are no escape characters, so the custom characters
+ *  0-7 can be placed.
+ */
+void lcd_renderRaw(struct lcd *lcd, const unsigned char *data, size_t n){
+  while (n > 0) {
+    lcd_renderChar(lcd, *data, 0);
+    data++;
+    n--;
+  }
+}
+
+// put one character or glyph at the cursor, jump to next row if line ends
+static void lcd_renderChar(struct lcd *lcd, unsigned char c, unsigned char glyph){
+  if (lcd->cursor.col < lcd->cursor.col_max) {
+    lcd->frame.cell[lcd->cursor.row * lcd->cursor.col_max + lcd->cursor.col] = c;
+    lcd->frame.glyph[lcd->cursor.row * lcd->cursor.col_max + lcd->cursor.col] = glyph;
+  }
+
+  lcd->cursor.col++;
+  if (lcd->cursor.col >= lcd->cursor.col_max) {
+    lcd->cursor.col = 0;
+    lcd->cursor.row++;
+    if(lcd->cursor.row >= lcd->cursor.row_max){
+      lcd->cursor.row = 0;
+    }    
+  }
+}
+
+static void lcd_setRowOffsets(struct lcd *lcd, int row0, int row1, int row2, int row3){
+  lcd->cursor.row_offsets[0] = row0;
+  lcd->cursor.row_offsets[1] = row1;
+  lcd->cursor.row_offsets[2] = row2;
+  lcd->cursor.row_offsets[3] = row3;  
 }
 
 /***** mid level commands, for sending data/cmds ******/
 
-void lcd_command(unsigned char value){
-  lcd_send(value, LCD_LOW);
+void lcd_command(struct lcd *lcd, unsigned char value){
+  lcd_send(lcd, value, LCD_LOW);
+}
+
+void lcd_write(struct lcd *lcd, unsigned char value){
+  if (lcd->cursor.col < lcd->cursor.col_max) {
+    lcd->frame.cell[lcd->cursor.row * lcd->cursor.col_max + lcd->cursor.col] = value;
+    lcd->frame.glyph[lcd->cursor.row * lcd->cursor.col_max + lcd->cursor.col] = 0;
+  }
+  lcd_putc(lcd, value);
+
+  lcd->cursor.col++;
+  if(lcd->cursor.col >= lcd->cursor.col_max){
+    lcd->cursor.col = 0;
+    lcd->cursor.row++;
+  }
+  if(lcd->cursor.row >= lcd->cursor.row_max){
+    lcd->cursor.row = 0;
+  }
+}
+
+/****** shadow framebuffer ******/
+
+// Write one character to DDRAM and keep the shadow copy up to date
+static void lcd_putc(struct lcd *lcd, unsigned char value){
+  unsigned char width = lcd_lineWidth(lcd);
+
+  lcd_send(lcd, value, LCD_HIGH);
+  // autoscroll shifts the display with every character
+  if (lcd->display.mode & LCD_ENTRYSHIFTINCREMENT) {
+    lcd->frame.shift_owned = false;
+    lcd->frame.shift = (lcd->frame.shift + ((lcd->display.mode & LCD_ENTRYLEFT) ? 1 : width - 1)) % width;
+  }
+  if (lcd->frame.addr_valid) {
+    lcd->frame.ddram[lcd->frame.addr] = value;
+    lcd_advanceAddr(lcd);
+  }
+}
+
+static void lcd_setAddr(struct lcd *lcd, unsigned char addr){
+  addr &= LCD_DDRAM_SIZE - 1;
+  trace_lcd_set_addr(lcd, addr, lcd->frame.addr_valid && lcd->frame.addr == addr);
+  lcd_command(lcd, LCD_SETDDRAMADDR | addr);
+  lcd->frame.addr = addr;
+  lcd->frame.addr_valid = true;
+}
+
+// Follow the auto increment/decrement of the controller's address counter
+static void lcd_advanceAddr(struct lcd *lcd){
+  unsigned char addr = lcd->frame.addr;
+
+  if (lcd->display.mode & LCD_ENTRYLEFT) {
+    if (!(lcd->display.function & LCD_2LINE)) {
+      addr = (addr >= 0x4F) ? 0x00 : addr + 1;
+    }
+    else if (addr == 0x27) {
+      addr = 0x40;
+    }
+    else {
+      addr = (addr >= 0x67) ? 0x00 : addr + 1;
+    }
+  }
+  else {
+    if (!(lcd->display.function & LCD_2LINE)) {
+      addr = (addr == 0x00) ? 0x4F : addr - 1;
+    }
+    else if (addr == 0x40) {
+      addr = 0x27;
+    }
+    else {
+      addr = (addr == 0x00) ? 0x67 : addr - 1;
+    }
+  }
+  lcd->frame.addr = addr;
+}
+
+static void lcd_clearDisplay(struct lcd *lcd){
+  lcd_sendWait(lcd, LCD_CLEARDISPLAY, LCD_LOW, lcd->timing.clear);   // clear display, set cursor to zero
+  // the clear sets the entry mode to increment, right to left text keeps its direction
+  if (!(lcd->display.mode & LCD_ENTRYLEFT)) {
+    lcd_command(lcd, LCD_ENTRYMODESET | lcd->display.mode);
+  }
+  memset(lcd->frame.ddram, ' ', sizeof(lcd->frame.ddram));
+  lcd->frame.addr = 0;
+  lcd->frame.addr_valid = true;
+  lcd->frame.shift = 0;
+}
+
+// Cells of one DDRAM line, the display shift wraps around within it
+static unsigned char lcd_lineWidth(struct lcd *lcd){
+  return (lcd->display.function & LCD_2LINE) ? 40 : 80;
+}
+
+// DDRAM address of a cell with the display shifted by view columns
+static unsigned char lcd_cellAddr(struct lcd *lcd, unsigned char row, unsigned char col, unsigned char view){
+  unsigned char base = (lcd->display.function & LCD_2LINE) ? (lcd->cursor.row_offsets[row] & 0x40) : 0;
+
+  return base + (lcd->cursor.row_offsets[row] - base + col + view) % lcd_lineWidth(lcd);
+}
+
+// Shift instructions needed to go from column from to column to
+static unsigned char lcd_shiftDistance(struct lcd *lcd, unsigned char from, unsigned char to){
+  unsigned char width = lcd_lineWidth(lcd);
+  unsigned char left = (to + width - from) % width;
+
+  return (left <= width / 2) ? left : width - left;
 }
 
-void lcd_write(unsigned char value){
-  _cursor.col++;
-  if(_cursor.col >= _cursor.col_max){
-    _cursor.col = 0;
-    _cursor.row++;
+// Shift the display until column view is shown first, the shorter way round
+static void lcd_shiftTo(struct lcd *lcd, unsigned char view){
+  unsigned char width = lcd_lineWidth(lcd);
+  unsigned char left = (view + width - lcd->frame.shift) % width;
+
+  if (left <= width / 2) {
+    while (left--) {
+      lcd_moveDisplay(lcd, LCD_DISPLAYMOVE | LCD_MOVELEFT);
+    }
   }
-  if(_cursor.row >= _cursor.row_max){
-    _cursor.row = 0;
+  else {
+    for (left = width - left; left > 0; left--) {
+      lcd_moveDisplay(lcd, LCD_DISPLAYMOVE | LCD_MOVERIGHT);
+    }
   }
-  lcd_send(value, LCD_HIGH);
 }
 
 /****** low level data pushing commands ******/
 
-static void lcd_send(unsigned char value, unsigned char mode){
-  gpio_set_value(_pin.rs, mode);
+// RW is only raised by the read of the bus backend, which pulls it low again
+static void lcd_send(struct lcd *lcd, unsigned char value, unsigned char mode){
+  lcd_sendWait(lcd, value, mode, (mode == LCD_HIGH) ? lcd->timing.data : lcd->timing.command);
+}
+
+// Send one byte, then wait us or until the busy flag is cleared
+static void lcd_sendWait(struct lcd *lcd, unsigned char value, unsigned char mode, unsigned int us){
+  u64 start = 0;
+
+  if (trace_lcd_command_enabled() || trace_lcd_data_enabled() ||
+      trace_lcd_clear_enabled() || trace_lcd_home_enabled()) {
+    start = ktime_get_ns();
+  }
+  lcd->stats.bytes++;
+  if (mode == LCD_HIGH) {
+    lcd->stats.data++;
+  }
+  else if (value) {
+    lcd->stats.commands[fls(value) - 1]++;
+  }
+
+  if (lcd->display.function & LCD_8BITMODE) {
+    lcd_write8bits(lcd, value, mode);
+  }
+  else {
+    lcd_write4bits(lcd, value >> 4, mode);
+    lcd_write4bits(lcd, value, mode);
+  }
 
-  // if there is a RW pin indicated, set it low to Write
-  if(_pin.rw != 255){
-    gpio_set_value(_pin.rw, LCD_LOW);
+  if (lcd->pin.busyflag) {
+    lcd_waitBusy(lcd, us);
+  }
+  else {
+    lcd_delay(lcd, us);
   }
+  lcd_syncBus(lcd);
 
-  if (_display.function & LCD_8BITMODE) {
-    lcd_write8bits(value);
+  if (start) {
+    lcd_traceSend(lcd, value, mode, ktime_get_ns() - start);
+  }
+}
+
+// Pick the tracepoint of the byte that was sent
+static void lcd_traceSend(struct lcd *lcd, unsigned char value, unsigned char mode, u64 elapsed_ns){
+  if (mode == LCD_HIGH) {
+    trace_lcd_data(lcd, value, true, elapsed_ns);
+  }
+  else if (value == LCD_CLEARDISPLAY) {
+    trace_lcd_clear(lcd, value, false, elapsed_ns);
+  }
+  else if ((value & ~0x01) == LCD_RETURNHOME) {
+    trace_lcd_home(lcd, value, false, elapsed_ns);
   }
   else {
-    lcd_write4bits(value >> 4);
-    lcd_write4bits(value);
+    trace_lcd_command(lcd, value, false, elapsed_ns);
   }
 }
 
-static void lcd_pulseEnable(void){
-  gpio_set_value(_pin.enable, LCD_LOW);
-  udelay(1);
-  gpio_set_value(_pin.enable, LCD_HIGH);
-  udelay(2);     // enable pulse must be > 450ns
-  gpio_set_value(_pin.enable, LCD_LOW);
-  udelay(100);   // commands need > 73us to settle
+static void lcd_pulseEnable(struct lcd *lcd){
+  lcd->stats.pulses++;
+  lcd->bus->pulse(lcd);
+  // the execution time is waited for once per byte, see lcd_sendWait()
 }
 
-static void lcd_write4bits(unsigned char value){
-  int i;
-  for (i = 0; i < 4; i++) {
-    gpio_set_value(_pin.data[i], LCD_HIGH ? ((value >> i) & 0x01) : (((value >> i) & 0x01) ^ 0x01));
+static void lcd_delay(struct lcd *lcd, unsigned int us){
+  lcd->bus->delay(lcd, us);
+}
+
+// Let the bus queue the bytes until lcd_releaseBus(), e.g. the whole flush
+static void lcd_holdBus(struct lcd *lcd){
+  lcd->bus_hold++;
+}
+static void lcd_releaseBus(struct lcd *lcd){
+  lcd->bus_hold--;
+  lcd_syncBus(lcd);
+}
+// Send what the bus queued, unless the running operation holds it
+static void lcd_syncBus(struct lcd *lcd){
+  if (lcd->bus_hold == 0 && lcd->bus->sync) {
+    lcd->bus->sync(lcd);
   }
-  lcd_pulseEnable();
 }
-static void lcd_write8bits(unsigned char value){
+
+/**
+ *  @brief Wait on the cpu, the delay of the bus backends
+ *  Waits long enough to be worth a context switch sleep and leave the cpu to
+ *  other tasks, all callers run in process context. Shorter ones are spun:
+ *  a sleep costs some 6us of cpu and wakes up some 7us late, below 20us that
+ *  is more than the wait itself.
+ */
+void lcd_wait(struct lcd *lcd, unsigned int us){
+  if (us < LCD_SLEEP_MIN_US) {
+    udelay(us);
+    lcd->stats.spun_us += us;
+  }
+  else if (us < 20000) {
+    usleep_range(us, us + us / 4);
+    lcd->stats.slept_us += us;
+  }
+  else {
+    msleep(us / 1000);
+    lcd->stats.slept_us += us;
+  }
+}
+
+static void lcd_write4bits(struct lcd *lcd, unsigned char value, unsigned char mode){
+  lcd->bus->set_lines(lcd, value & 0x0F, mode == LCD_HIGH);
+  lcd_pulseEnable(lcd);
+  trace_lcd_pulse(lcd, value & 0x0F, mode == LCD_HIGH);
+}
+static void lcd_write8bits(struct lcd *lcd, unsigned char value, unsigned char mode){
+  lcd->bus->set_lines(lcd, value, mode == LCD_HIGH);
+  lcd_pulseEnable(lcd);
+  trace_lcd_pulse(lcd, value, mode == LCD_HIGH);
+}
+
+/**
+ *  @brief Poll the busy flag until the controller accepts the next instruction
+ *  Once the flag is seen set, most of the execution time is waited in one go,
+ *  which sleeps, instead of spinning through polls.
+ *  @param us execution time of the instruction
+ */
+static void lcd_waitBusy(struct lcd *lcd, unsigned int us){
   int i;
-  for (i = 0; i < 8; i++) {
-    gpio_set_value(_pin.data[i], LCD_HIGH ? ((value >> i) & 0x01) : (((value >> i) & 0x01) ^ 0x01));
+
+  for (i = 0; i < LCD_BUSYPOLLS; i++) {
+    if (!(lcd->bus->read(lcd, false) & LCD_BUSYFLAG)) {
+      return;
+    }
+    lcd_delay(lcd, i == 0 ? us - us / 4 : 10);
   }
-  lcd_pulseEnable();
+
+  // the busy flag never cleared, the display stopped answering
+  printk(KERN_WARNING "Lcd: busy flag stuck, falling back to fixed delays\n");
+  lcd->pin.busyflag = false;
+  lcd_delay(lcd, lcd->timing.clear);
+}
+
+/**
+ *  @brief Check the read path before the busy flag is trusted
+ *  A data line that does not follow the controller, e.g. behind a one way
+ *  level shifter, reads as "not busy" and every wait would be skipped. The
+ *  flag has to be set during a return home, and the address counter has to
+ *  read back as set.
+ */
+static bool lcd_checkRead(struct lcd *lcd){
+  // valid in both line modes, different nibbles
+  const unsigned char addr = 0x4A;
+  unsigned char value;
+
+  lcd_command(lcd, LCD_RETURNHOME);
+  value = lcd->bus->read(lcd, false);   // still within the execution time of the return home
+  lcd_delay(lcd, lcd->timing.home);
+  lcd->frame.addr = 0;
+  lcd_setAddr(lcd, addr);
+  return (value & LCD_BUSYFLAG) && lcd->bus->read(lcd, false) == addr;
+}
+
+// Read the character or CGRAM row at the address counter, which moves on afterwards
+static unsigned char lcd_readData(struct lcd *lcd){
+  unsigned char value = lcd->bus->read(lcd, true);
+
+  lcd_waitBusy(lcd, lcd->timing.data);
+  return value;
 }
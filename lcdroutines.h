@@ -11,6 +11,8 @@
 #define _LCDROUTINES_H
 
 #include <linux/string.h>
+#include <linux/types.h>
+#include "lcdCharset.h"
 //#include <stdbool.h>
 
 // define logic levels
@@ -27,13 +29,13 @@
 #define LCD_SETCGRAMADDR 0x40
 #define LCD_SETDDRAMADDR 0x80
 
-// _display.mode: flags for display entry mode
+// lcd->display.mode: flags for display entry mode
 #define LCD_ENTRYRIGHT 0x00
 #define LCD_ENTRYLEFT 0x02
 #define LCD_ENTRYSHIFTINCREMENT 0x01
 #define LCD_ENTRYSHIFTDECREMENT 0x00
 
-// _display.control: flags for display on/off control
+// lcd->display.control: flags for display on/off control
 #define LCD_DISPLAYON 0x04
 #define LCD_DISPLAYOFF 0x00
 #define LCD_CURSORON 0x02
@@ -41,7 +43,7 @@
 #define LCD_BLINKON 0x01
 #define LCD_BLINKOFF 0x00
 
-// _display.function: flags for function set
+// lcd->display.function: flags for function set
 #define LCD_8BITMODE 0x10
 #define LCD_4BITMODE 0x00
 #define LCD_2LINE 0x08
@@ -55,54 +57,273 @@
 #define LCD_MOVERIGHT 0x04
 #define LCD_MOVELEFT 0x00
 
+// status read: busy flag, the lower 7 bits hold the address counter
+#define LCD_BUSYFLAG 0x80
+#define LCD_BUSYPOLLS 300  // give up after ~3ms, longer than any instruction
+
+// shorter waits are spun, longer ones sleep and leave the cpu to other tasks
+#define LCD_SLEEP_MIN_US 20
+
+// outputs of the serial backpacks, a port expander or a shift register, D4-D7 on the upper nibble
+#define LCD_PORT_RS        0x01
+#define LCD_PORT_RW        0x02
+#define LCD_PORT_ENABLE    0x04
+#define LCD_PORT_BACKLIGHT 0x08
+
+// execution times in us, used if the busy flag cannot be polled
+struct lcd_timing {
+  const char *name;          // controller the values are taken from
+  unsigned int clear;        // clear display
+  unsigned int home;         // return home
+  unsigned int command;      // all other instructions
+  unsigned int data;         // write to DDRAM or CGRAM, including the address update
+  unsigned int pulse;        // enable pulse width
+};
+
+// instruction classes, index is the position of the highest bit of the instruction
+#define LCD_CMD_CLASSES 8
+
+struct lcd_stats {
+  unsigned long gpio_calls;  // gpio api calls or bank register writes
+  unsigned long bus_bytes;   // bytes on a serial bus (i2c), what the port expander is sent
+  unsigned long transfers;   // serial bus transfers, each one start to stop
+  unsigned long bytes;       // instructions and characters sent
+  unsigned long data;        // characters and CGRAM rows sent
+  unsigned long commands[LCD_CMD_CLASSES];   // instructions by class, clear ... set DDRAM address
+  unsigned long pulses;      // enable pulses
+  unsigned long slept_us;    // time waited without using the cpu
+  unsigned long spun_us;     // time waited in busy loops
+  unsigned long resyncs;     // read backs of the controller, see lcd_resync()
+  unsigned long repairs;     // cells and CGRAM slots they found changed
+};
+
+// display geometry limits of a single HD44780 controller
+#define LCD_MAX_ROWS 4
+#define LCD_MAX_COLS 40
+#define LCD_DDRAM_SIZE 0x80
+#define LCD_DDRAM_CELLS 80    // cells the address counter runs through, both line modes
+#define LCD_FRAME_SIZE (LCD_MAX_ROWS * LCD_MAX_COLS)
+
+// custom characters: 8 CGRAM slots are shared by a larger set of registered glyphs
+#define LCD_CGRAM_SLOTS 8
+#define LCD_USER_GLYPHS 64                                  // registered by lcd_registerGlyph()
+#define LCD_GLYPHS (LCD_USER_GLYPHS + LCD_CHARSET_GLYPHS)   // followed by those of the character set
+#define LCD_SLOT_RAW 0xFF  // slot written by lcd_createChar(), not managed by the cache
+
+// marquee: a row scrolled by the display shift, one instruction per step
+#define LCD_MARQUEE_MAX 128
+#define LCD_MARQUEE_GAP 4   // blanks before the text starts over
+
+struct lcd_marquee {
+  bool active;
+  unsigned char row;
+  unsigned int period;               // cells until the text repeats, at least one DDRAM line
+  unsigned long step;                // steps since the text was set
+  unsigned char text[LCD_MARQUEE_MAX + LCD_MARQUEE_GAP];
+};
+
+// update planner: DDRAM content a flush has to reach, scratch space of lcd_flush()
+#define LCD_PLAN_SHIFTS 4   // display shifts tried to follow content that moved sideways
+
+struct lcd_plan {
+  unsigned char want[LCD_DDRAM_SIZE];
+  bool used[LCD_DDRAM_SIZE];         // false: the cell is not shown, any content will do
+};
+
+struct lcd;
+
+/**
+ *  The bus a display is connected by. set_lines() and pulse() write one
+ *  nibble (4 bit mode) or byte, the protocol and the execution times are
+ *  handled by lcdroutines.c.
+ *
+ *  A backend behind a serial bus may queue the writes and short delays and
+ *  send them as one transfer. lcdroutines.c calls sync() at the end of every
+ *  operation, a whole flush being one.
+ */
+struct lcd_bus_ops {
+  const char *name;
+  unsigned char wire_bits;                                       // serial backends: bit times per byte, 0 if parallel
+  int  (*init)(struct lcd *lcd);                                 // claim the lines, called by lcd_init()
+  void (*uninit)(struct lcd *lcd);
+  void (*set_lines)(struct lcd *lcd, unsigned char value, bool rs);   // data lines and RS (true: data)
+  void (*pulse)(struct lcd *lcd);                                // enable pulse, including the setup time
+  void (*delay)(struct lcd *lcd, unsigned int us);               // lcd_wait() unless the bus can fill the time
+  unsigned char (*read)(struct lcd *lcd, bool rs);               // optional, read a byte with RW high
+  void (*sync)(struct lcd *lcd);                                 // optional, send what is queued
+};
+
+// geometry and wiring of a display
+struct lcd_config {
+  unsigned char cols;
+  unsigned char rows;
+  bool fourbitmode;
+  unsigned char rs;
+  unsigned char rw;      // 255 if RW is connected to ground
+  unsigned char enable;
+  unsigned char data[8];
+  const char *controller;  // timing profile, see lcd_findTiming(), NULL for the HD44780
+  const char *charset;     // character ROM, see lcd_findCharset(), NULL for A00
+  const struct lcd_bus_ops *bus;
+  int port;                // serial backends: i2c adapter or spi bus number
+  unsigned short addr;     // i2c address of the port expander, spi chip select
+  unsigned int khz;        // bus clock, paces the delays on the bus
+};
+
+// state of one display
+struct lcd {
+  struct{
+    unsigned char rs; // LOW: command.  HIGH: character.
+    unsigned char rw; // LOW: write to LCD.  HIGH: read from LCD.
+    unsigned char enable; // activated by a HIGH pulse.
+    unsigned char data[8];
+    bool busyflag; // RW is wired and the busy flag may be polled
+    int nbus;      // number of data pins in use
+  } pin;
+
+  const struct lcd_bus_ops *bus;
+  void *bus_data;    // state of the bus backend
+  int bus_hold;      // > 0 while the operations of lcdroutines.c may be queued by the bus
+
+  struct{
+    int port;
+    unsigned short addr;
+    unsigned int khz;
+  } link;            // serial bus of the display, see lcd_config
+
+  struct{
+    unsigned char function;
+    unsigned char control;
+    unsigned char mode;
+  } display;
+
+  struct lcd_timing timing;
+
+  struct{
+    unsigned char row_max;
+    unsigned char col_max;
+    unsigned char row_offsets[4];
+    unsigned char row;
+    unsigned char col;
+  } cursor;
+
+  struct{
+    unsigned char ddram[LCD_DDRAM_SIZE];             // shadow copy of the controller's DDRAM
+    unsigned char *cell;                             // frame being rendered, page for mmap()
+    unsigned char next[LCD_FRAME_SIZE];              // committed frame, sent by lcd_flush()
+    unsigned char next_row;                          // cursor of the committed frame
+    unsigned char next_col;
+    unsigned char next_addr;                         // cursor address, set by lcd_flush()
+    unsigned char addr;                              // controller's DDRAM address counter
+    bool addr_valid;                                 // false if the address counter is unknown
+    bool clear;                                      // rendered frame starts with a display clear
+    bool next_clear;                                 // committed frame starts with a display clear
+    unsigned char glyph[LCD_FRAME_SIZE];             // glyph number + 1 of the rendered cells, 0: none
+    unsigned char next_glyph[LCD_FRAME_SIZE];        // glyphs of the committed frame
+    unsigned char shift;                             // display shift, DDRAM column shown in the first column
+    bool shift_owned;                                // the shift belongs to lcd_flush(), not to lcd_shift()
+    bool plan;                                       // lcd_flush() plans the update, see lcd_setPlanner()
+  } frame;
+
+  struct lcd_plan plan;
+
+  struct lcd_marquee marquee;                        // rendered marquee
+  struct lcd_marquee next_marquee;                   // committed marquee, sent by lcd_flush()
+
+  struct{
+    unsigned char bitmap[LCD_GLYPHS][8];             // registered glyphs
+    unsigned char fallback[LCD_GLYPHS];              // character in the frame, shown if no slot is left
+    bool defined[LCD_GLYPHS];
+    unsigned char slot[LCD_GLYPHS];                  // slot + 1 holding the glyph, 0: not loaded
+    unsigned char owner[LCD_CGRAM_SLOTS];            // glyph + 1 in the slot, 0: free, LCD_SLOT_RAW
+    unsigned long used[LCD_CGRAM_SLOTS];             // flush of the last use, for LRU eviction
+    unsigned long clock;                             // counts the flushes
+    unsigned char cgram[LCD_CGRAM_SLOTS][8];         // shadow copy of the controller's CGRAM
+    bool cgram_valid[LCD_CGRAM_SLOTS];
+  } glyph;
+
+  const struct lcd_charset *charset;                 // translates what lcd_render() gets
+  struct lcd_utf8 utf8;                              // sequence that continues with the next lcd_render()
+
+  struct lcd_stats stats;
+};
 
 /****** initialization functions ******/
-void lcd_init(unsigned char cols, unsigned char lines,
-	      unsigned char fourbitmode, unsigned char rs, unsigned char rw, unsigned char enable,
-	      unsigned char d0, unsigned char d1, unsigned char d2, unsigned char d3,
-	      unsigned char d4, unsigned char d5, unsigned char d6, unsigned char d7);
-void lcd_uninit(void);
+int  lcd_init(struct lcd *lcd, const struct lcd_config *config);
+void lcd_uninit(struct lcd *lcd);
+const struct lcd_timing *lcd_findTiming(const char *name);
+const struct lcd_timing *lcd_getTimingProfile(unsigned int i);
+void lcd_setTiming(struct lcd *lcd, const struct lcd_timing *timing);
+void lcd_getTiming(struct lcd *lcd, struct lcd_timing *timing);
+void lcd_getStats(struct lcd *lcd, struct lcd_stats *stats);
+void lcd_setPlanner(struct lcd *lcd, bool on);
+const char *lcd_getCommandName(unsigned int cmdclass);
 
 /****** high level commands, for the user ******/
-void lcd_clear(void);
-void lcd_home(void);
+void lcd_clear(struct lcd *lcd);
+void lcd_home(struct lcd *lcd);
 
-void lcd_print(const char *str);
-void lcd_printn(char *str, size_t n);
-void lcd_update(char *str);
-void lcd_updaten(char *str, size_t n);
+void lcd_print(struct lcd *lcd, const char *str);
+void lcd_printn(struct lcd *lcd, char *str, size_t n);
+void lcd_update(struct lcd *lcd, char *str);
+void lcd_updaten(struct lcd *lcd, char *str, size_t n);
+void lcd_render(struct lcd *lcd, char *str, size_t n);
+void lcd_renderRaw(struct lcd *lcd, const unsigned char *data, size_t n);
+bool lcd_commit(struct lcd *lcd);
+void lcd_flush(struct lcd *lcd);
+int  lcd_resync(struct lcd *lcd);
+size_t lcd_getFrame(struct lcd *lcd, char *buf, size_t size);
 
-void lcd_noDisplay(void);
-void lcd_display(void);
-bool lcd_isDisplayOn(void);
+void lcd_noDisplay(struct lcd *lcd);
+void lcd_display(struct lcd *lcd);
+bool lcd_isDisplayOn(struct lcd *lcd);
 
-void lcd_noBlink(void);
-void lcd_blink(void);
-bool lcd_isBlinkOn(void);
+void lcd_noBlink(struct lcd *lcd);
+void lcd_blink(struct lcd *lcd);
+bool lcd_isBlinkOn(struct lcd *lcd);
 
-void lcd_noCursor(void);
-void lcd_cursor(void);
-bool lcd_isCursorOn(void);
+void lcd_noCursor(struct lcd *lcd);
+void lcd_cursor(struct lcd *lcd);
+bool lcd_isCursorOn(struct lcd *lcd);
 
-void lcd_autoscroll(void);
-void lcd_noAutoscroll(void);
-bool lcd_isAutoscroll(void);
+void lcd_autoscroll(struct lcd *lcd);
+void lcd_noAutoscroll(struct lcd *lcd);
+bool lcd_isAutoscroll(struct lcd *lcd);
 
-void lcd_scrollDisplayLeft(void);
-void lcd_scrollDisplayRight(void);
+void lcd_scrollDisplayLeft(struct lcd *lcd);
+void lcd_scrollDisplayRight(struct lcd *lcd);
 
-void lcd_leftToRight(void);
-void lcd_rightToLeft(void);
-bool lcd_isLeftToRight(void);
+void lcd_leftToRight(struct lcd *lcd);
+void lcd_rightToLeft(struct lcd *lcd);
+bool lcd_isLeftToRight(struct lcd *lcd);
 
-void lcd_createChar(unsigned char, unsigned char[]);
+void lcd_setControl(struct lcd *lcd, unsigned char control);
+void lcd_setEntryMode(struct lcd *lcd, unsigned char mode);
+unsigned char lcd_getControl(struct lcd *lcd);
+unsigned char lcd_getEntryMode(struct lcd *lcd);
+void lcd_shift(struct lcd *lcd, unsigned char flags);
 
-void lcd_setCursor(unsigned char, unsigned char);
-unsigned char lcd_getCursorPosRow(void);
-unsigned char lcd_getCursorPosCol(void);
+int  lcd_setMarquee(struct lcd *lcd, unsigned char row, const char *text, size_t n);
+bool lcd_stepMarquee(struct lcd *lcd);
+bool lcd_getMarquee(struct lcd *lcd, unsigned char *row, char *text, size_t size);
+
+void lcd_createChar(struct lcd *lcd, unsigned char, unsigned char[]);
+int  lcd_registerGlyph(struct lcd *lcd, unsigned int glyph, const unsigned char bitmap[8], unsigned char fallback);
+void lcd_renderGlyph(struct lcd *lcd, unsigned int glyph);
+
+void lcd_setCursor(struct lcd *lcd, unsigned char, unsigned char);
+void lcd_moveCursor(struct lcd *lcd, unsigned char, unsigned char);
+unsigned char lcd_getCursorPosRow(struct lcd *lcd);
+unsigned char lcd_getCursorPosCol(struct lcd *lcd);
+unsigned char lcd_getRows(struct lcd *lcd);
+unsigned char lcd_getCols(struct lcd *lcd);
+unsigned char *lcd_getFrameBuffer(struct lcd *lcd);
 
 /***** mid level commands, for sending data/cmds ******/
-void lcd_write(unsigned char);
-void lcd_command(unsigned char);
+void lcd_write(struct lcd *lcd, unsigned char);
+void lcd_command(struct lcd *lcd, unsigned char);
+
+/****** for the bus backends ******/
+void lcd_wait(struct lcd *lcd, unsigned int us);
 
 #endif
@@ -0,0 +1,123 @@
+/**
+ * @file lcdtrace.h
+ * @brief Tracepoints of the bus and frame path, system "lcdchar".
+ *
+ * Enable with e.g. "echo 1 > /sys/kernel/debug/tracing/events/lcdchar/enable".
+ * Disabled tracepoints cost a patched out branch, the timestamps for
+ * elapsed_ns are only taken while one of the events is enabled.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lcdchar
+
+#if !defined(_LCDTRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _LCDTRACE_H
+
+#include <linux/tracepoint.h>
+
+// one byte sent, elapsed_ns includes the wait for the execution time
+DECLARE_EVENT_CLASS(lcd_send_class,
+  TP_PROTO(const void *lcd, unsigned char value, bool rs, u64 elapsed_ns),
+  TP_ARGS(lcd, value, rs, elapsed_ns),
+  TP_STRUCT__entry(
+    __field(const void *, lcd)
+    __field(unsigned char, value)
+    __field(bool, rs)
+    __field(u64, elapsed_ns)
+  ),
+  TP_fast_assign(
+    __entry->lcd = lcd;
+    __entry->value = value;
+    __entry->rs = rs;
+    __entry->elapsed_ns = elapsed_ns;
+  ),
+  TP_printk("lcd=%p value=0x%02x rs=%d elapsed_ns=%llu",
+	    __entry->lcd, __entry->value, __entry->rs, __entry->elapsed_ns)
+);
+
+DEFINE_EVENT(lcd_send_class, lcd_command,
+  TP_PROTO(const void *lcd, unsigned char value, bool rs, u64 elapsed_ns),
+  TP_ARGS(lcd, value, rs, elapsed_ns));
+DEFINE_EVENT(lcd_send_class, lcd_data,
+  TP_PROTO(const void *lcd, unsigned char value, bool rs, u64 elapsed_ns),
+  TP_ARGS(lcd, value, rs, elapsed_ns));
+DEFINE_EVENT(lcd_send_class, lcd_clear,
+  TP_PROTO(const void *lcd, unsigned char value, bool rs, u64 elapsed_ns),
+  TP_ARGS(lcd, value, rs, elapsed_ns));
+DEFINE_EVENT(lcd_send_class, lcd_home,
+  TP_PROTO(const void *lcd, unsigned char value, bool rs, u64 elapsed_ns),
+  TP_ARGS(lcd, value, rs, elapsed_ns));
+
+// one enable pulse, value holds the nibble in 4 bit mode
+TRACE_EVENT(lcd_pulse,
+  TP_PROTO(const void *lcd, unsigned char value, bool rs),
+  TP_ARGS(lcd, value, rs),
+  TP_STRUCT__entry(
+    __field(const void *, lcd)
+    __field(unsigned char, value)
+    __field(bool, rs)
+  ),
+  TP_fast_assign(
+    __entry->lcd = lcd;
+    __entry->value = value;
+    __entry->rs = rs;
+  ),
+  TP_printk("lcd=%p value=0x%02x rs=%d", __entry->lcd, __entry->value, __entry->rs)
+);
+
+// DDRAM address set, redundant if the address counter already pointed there
+TRACE_EVENT(lcd_set_addr,
+  TP_PROTO(const void *lcd, unsigned char addr, bool redundant),
+  TP_ARGS(lcd, addr, redundant),
+  TP_STRUCT__entry(
+    __field(const void *, lcd)
+    __field(unsigned char, addr)
+    __field(bool, redundant)
+  ),
+  TP_fast_assign(
+    __entry->lcd = lcd;
+    __entry->addr = addr;
+    __entry->redundant = redundant;
+  ),
+  TP_printk("lcd=%p addr=0x%02x redundant=%d", __entry->lcd, __entry->addr, __entry->redundant)
+);
+
+TRACE_EVENT(lcd_flush_start,
+  TP_PROTO(const void *lcd, bool clear),
+  TP_ARGS(lcd, clear),
+  TP_STRUCT__entry(
+    __field(const void *, lcd)
+    __field(bool, clear)
+  ),
+  TP_fast_assign(
+    __entry->lcd = lcd;
+    __entry->clear = clear;
+  ),
+  TP_printk("lcd=%p clear=%d", __entry->lcd, __entry->clear)
+);
+
+// bytes: instructions and characters sent for the frame
+TRACE_EVENT(lcd_flush_end,
+  TP_PROTO(const void *lcd, unsigned long bytes, u64 elapsed_ns),
+  TP_ARGS(lcd, bytes, elapsed_ns),
+  TP_STRUCT__entry(
+    __field(const void *, lcd)
+    __field(unsigned long, bytes)
+    __field(u64, elapsed_ns)
+  ),
+  TP_fast_assign(
+    __entry->lcd = lcd;
+    __entry->bytes = bytes;
+    __entry->elapsed_ns = elapsed_ns;
+  ),
+  TP_printk("lcd=%p bytes=%lu elapsed_ns=%llu", __entry->lcd, __entry->bytes, __entry->elapsed_ns)
+);
+
+#endif /* _LCDTRACE_H */
+
+// this part must be outside the include guard
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE lcdtrace
+#include <trace/define_trace.h>
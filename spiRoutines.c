@@ -0,0 +1,222 @@
+#include "spiRoutines.h"
+#include <linux/cache.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/spi/spi.h>
+
+#define LCD_SPI_BATCH   64    // latched values of one message at most
+#define LCD_SPI_FILL    512   // bytes a wait may be shifted through the register, longer ones sleep
+
+// state of the spi backend, lcd->bus_data
+struct lcd_spi {
+  struct spi_master *master;
+  struct spi_device *spi;
+  unsigned char port;          // register outputs with enable low
+  unsigned int byte_ns;        // one byte shifted in
+  unsigned int fill;           // bytes shifted through before the next value, see lcdSpi_delay()
+  unsigned int bytes;          // bytes of the queued transfers
+  int len;                     // transfers queued
+  int values;                  // values of buf queued
+  struct spi_transfer xfer[2 * LCD_SPI_BATCH];
+  // may be mapped for dma
+  unsigned char buf[LCD_SPI_BATCH] ____cacheline_aligned;
+  unsigned char filler[LCD_SPI_FILL] ____cacheline_aligned;
+};
+
+static int  lcdSpi_init(struct lcd *lcd);
+static void lcdSpi_uninit(struct lcd *lcd);
+static void lcdSpi_setLines(struct lcd *lcd, unsigned char value, bool rs);
+static void lcdSpi_pulse(struct lcd *lcd);
+static void lcdSpi_delay(struct lcd *lcd, unsigned int us);
+static void lcdSpi_sync(struct lcd *lcd);
+static int  lcdSpi_send(struct lcd *lcd);
+static void lcdSpi_queue(struct lcd *lcd, unsigned char value);
+
+// RW stays low, a 74HC595 cannot be read back
+const struct lcd_bus_ops lcd_spi_ops = {
+  .name = "spi",
+  .wire_bits = 8,
+  .init = lcdSpi_init,
+  .uninit = lcdSpi_uninit,
+  .set_lines = lcdSpi_setLines,
+  .pulse = lcdSpi_pulse,
+  .delay = lcdSpi_delay,
+  .sync = lcdSpi_sync,
+};
+
+/**
+ *  @brief Add the shift register as a device on the spi bus and pull all outputs but the backlight low
+ *  @return 0 on success, -EINVAL in 8 bit mode, -ENODEV without the bus,
+ *  -EBUSY if the chip select is taken, -ENOMEM or the error of the first transfer
+ */
+static int lcdSpi_init(struct lcd *lcd){
+  struct spi_board_info info = {
+    .modalias = "lcd-hc595",
+    .mode = SPI_MODE_0,
+  };
+  struct lcd_spi *spi;
+  int ret;
+
+  if (lcd->pin.nbus != 4) {
+    printk(KERN_ALERT "Lcd: the 74HC595 only wires D4-D7, 4 bit mode is needed\n");
+    return -EINVAL;
+  }
+
+  spi = kzalloc(sizeof(*spi), GFP_KERNEL);
+  if (spi == NULL) {
+    return -ENOMEM;
+  }
+
+  spi->master = spi_busnum_to_master(lcd->link.port);
+  if (spi->master == NULL) {
+    printk(KERN_ALERT "Lcd: no spi bus %d\n", lcd->link.port);
+    ret = -ENODEV;
+    goto lcd_spi_free;
+  }
+
+  // the planner weighs the bytes by the clock, see lcd_byteCost()
+  if (lcd->link.khz == 0) {
+    lcd->link.khz = LCD_SPI_KHZ;
+  }
+  info.max_speed_hz = lcd->link.khz * 1000;
+  info.bus_num = lcd->link.port;
+  info.chip_select = lcd->link.addr;
+  spi->spi = spi_new_device(spi->master, &info);
+  if (spi->spi == NULL) {
+    ret = -EBUSY;
+    goto lcd_spi_put;
+  }
+  spi->byte_ns = 8000000 / lcd->link.khz;
+  lcd->bus_data = spi;
+
+  spi->port = LCD_PORT_BACKLIGHT;
+  lcdSpi_queue(lcd, spi->port);
+  ret = lcdSpi_send(lcd);
+  if (ret < 0) {
+    printk(KERN_ALERT "Lcd: 74HC595 at spi%d.%u not written (%d)\n", lcd->link.port, lcd->link.addr, ret);
+    goto lcd_spi_unregister;
+  }
+
+  printk(KERN_INFO "Lcd: 74HC595 at spi%d.%u, %u kHz\n", lcd->link.port, lcd->link.addr, lcd->link.khz);
+  return 0;
+
+ lcd_spi_unregister:
+  lcd->bus_data = NULL;
+  spi_unregister_device(spi->spi);
+ lcd_spi_put:
+  spi_master_put(spi->master);
+ lcd_spi_free:
+  kfree(spi);
+  return ret;
+}
+
+static void lcdSpi_uninit(struct lcd *lcd){
+  struct lcd_spi *spi = lcd->bus_data;
+
+  // all outputs low, the backlight goes off
+  spi->port = 0;
+  lcdSpi_queue(lcd, spi->port);
+  lcdSpi_sync(lcd);
+
+  spi_unregister_device(spi->spi);
+  spi_master_put(spi->master);
+  printk(KERN_INFO "Lcd: 74HC595 at spi%d.%u released\n", lcd->link.port, lcd->link.addr);
+
+  kfree(spi);
+  lcd->bus_data = NULL;
+}
+
+// The data lines go out with the rising edge of enable, only RS needs to be set up before it
+static void lcdSpi_setLines(struct lcd *lcd, unsigned char value, bool rs){
+  struct lcd_spi *spi = lcd->bus_data;
+  unsigned char port = ((value & 0x0F) << 4) | (rs ? LCD_PORT_RS : 0) | LCD_PORT_BACKLIGHT;
+
+  if ((port ^ spi->port) & LCD_PORT_RS) {
+    lcdSpi_queue(lcd, port);
+  }
+  spi->port = port;
+}
+
+// At high clocks enable is held by shifting bytes through until the pulse is long enough
+static void lcdSpi_pulse(struct lcd *lcd){
+  struct lcd_spi *spi = lcd->bus_data;
+
+  lcdSpi_queue(lcd, spi->port | LCD_PORT_ENABLE);
+  spi->fill = min_t(unsigned int, DIV_ROUND_UP(lcd->timing.pulse * 1000, spi->byte_ns) - 1, LCD_SPI_FILL);
+  lcdSpi_queue(lcd, spi->port);
+}
+
+/**
+ *  @brief Wait for the display
+ *  The register only changes its outputs when chip select rises at the end
+ *  of a transfer. A short wait makes the next transfer longer by bytes that
+ *  are shifted through, the spi controller waits instead of the cpu. Longer
+ *  ones send the queue and wait on the cpu, see lcd_wait().
+ */
+static void lcdSpi_delay(struct lcd *lcd, unsigned int us){
+  struct lcd_spi *spi = lcd->bus_data;
+  unsigned int fill = DIV_ROUND_UP(us * 1000, spi->byte_ns) - 1;
+
+  if (spi->len && fill <= LCD_SPI_FILL) {
+    spi->fill = max(spi->fill, fill);
+    return;
+  }
+  lcdSpi_sync(lcd);
+  lcd_wait(lcd, us);
+  spi->fill = 0;
+}
+
+static void lcdSpi_sync(struct lcd *lcd){
+  struct lcd_spi *spi = lcd->bus_data;
+  unsigned int bytes = spi->bytes;
+  int ret;
+
+  ret = lcdSpi_send(lcd);
+  if (ret < 0) {
+    printk_ratelimited(KERN_WARNING "Lcd: spi message of %u bytes failed (%d)\n", bytes, ret);
+  }
+}
+
+// Send the queued transfers as one message, a pending fill stays for the next one
+static int lcdSpi_send(struct lcd *lcd){
+  struct lcd_spi *spi = lcd->bus_data;
+  int ret;
+
+  if (spi->len == 0) {
+    return 0;
+  }
+  // chip select rises after every transfer, after the last one by the end of the message
+  spi->xfer[spi->len - 1].cs_change = 0;
+  ret = spi_sync_transfer(spi->spi, spi->xfer, spi->len);
+  lcd->stats.bus_bytes += spi->bytes;
+  lcd->stats.transfers++;
+  spi->len = spi->values = 0;
+  spi->bytes = 0;
+  return ret;
+}
+
+// One latched value, the bytes of a pending wait are shifted through before it within one chip select
+static void lcdSpi_queue(struct lcd *lcd, unsigned char value){
+  struct lcd_spi *spi = lcd->bus_data;
+  struct spi_transfer *xfer;
+
+  if (spi->values == LCD_SPI_BATCH) {
+    lcdSpi_sync(lcd);
+  }
+  if (spi->fill) {
+    xfer = &spi->xfer[spi->len++];
+    memset(xfer, 0, sizeof(*xfer));
+    xfer->tx_buf = spi->filler;
+    xfer->len = spi->fill;
+    spi->bytes += spi->fill;
+    spi->fill = 0;
+  }
+  spi->buf[spi->values] = value;
+
+  xfer = &spi->xfer[spi->len++];
+  memset(xfer, 0, sizeof(*xfer));
+  xfer->tx_buf = &spi->buf[spi->values++];
+  xfer->len = 1;
+  xfer->cs_change = 1;
+  spi->bytes++;
+}
@@ -0,0 +1,16 @@
+#ifndef _SPIROUTINES_H
+#define _SPIROUTINES_H
+
+#include "lcdroutines.h"
+
+// 74HC595 on SPI, Q0-Q7 wired as LCD_PORT_RS ... D7, the register latches when chip select rises
+#define LCD_SPI_KHZ 1000   // slow enough for long cables
+
+/**
+ *  Display behind a 74HC595 shift register, always in 4 bit mode and RW held
+ *  low. Every latched register value is one transfer of an spi_message, the
+ *  writes of an operation go out as one message.
+ */
+extern const struct lcd_bus_ops lcd_spi_ops;
+
+#endif
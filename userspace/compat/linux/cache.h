@@ -0,0 +1,6 @@
+#ifndef _COMPAT_CACHE_H
+#define _COMPAT_CACHE_H
+
+#define ____cacheline_aligned __attribute__((__aligned__(64)))
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef _COMPAT_DELAY_H
+#define _COMPAT_DELAY_H
+
+// waits of the serial backends, they pass on the clock of the modeled backpacks
+
+#include <linux/kernel.h>
+
+extern u64 lcd_model_clock;
+
+static inline void udelay(unsigned long us){
+  lcd_model_clock += (u64)us * 1000;
+}
+
+static inline void usleep_range(unsigned long min, unsigned long max){
+  lcd_model_clock += (u64)min * 1000;
+}
+
+static inline void msleep(unsigned int ms){
+  lcd_model_clock += (u64)ms * 1000000;
+}
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef _COMPAT_GFP_H
+#define _COMPAT_GFP_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#define GFP_KERNEL 0
+#define PAGE_SIZE  4096UL
+
+static inline unsigned long get_zeroed_page(int flags){
+  void *page = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+
+  if (page) {
+    memset(page, 0, PAGE_SIZE);
+  }
+  return (unsigned long)page;
+}
+
+static inline void free_page(unsigned long addr){
+  free((void *)addr);
+}
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef _COMPAT_I2C_H
+#define _COMPAT_I2C_H
+
+// the i2c api of the i2c backend, served by the adapter of pcf8574Model.c
+
+#include <linux/kernel.h>
+
+struct i2c_adapter_quirks {
+  u16 max_write_len;
+};
+
+struct i2c_adapter {
+  int nr;
+  const struct i2c_adapter_quirks *quirks;
+};
+
+struct i2c_client {
+  unsigned short addr;
+  struct i2c_adapter *adapter;
+};
+
+struct i2c_adapter *i2c_get_adapter(int nr);
+void i2c_put_adapter(struct i2c_adapter *adapter);
+struct i2c_client *i2c_new_dummy(struct i2c_adapter *adapter, u16 address);
+void i2c_unregister_device(struct i2c_client *client);
+int  i2c_master_send(const struct i2c_client *client, const char *buf, int count);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef _COMPAT_KERNEL_H
+#define _COMPAT_KERNEL_H
+
+// the parts of the kernel api lcdroutines.c uses, for a userspace build
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+
+#define KERN_ALERT   "<1>"
+#define KERN_ERR     "<3>"
+#define KERN_WARNING "<4>"
+#define KERN_INFO    "<6>"
+#define KERN_DEBUG   "<7>"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+#define BIT(n) (1UL << (n))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min_t(type, a, b) min((type)(a), (type)(b))
+#define fls(x) ((x) ? 32 - __builtin_clz(x) : 0)
+#define DIV_ROUND_UP(n, d) (((n) + (d) - 1) / (d))
+#define __iomem
+
+// prints warnings and worse, see mockRoutines.c
+int printk(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+#define printk_ratelimited printk
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef _COMPAT_KTIME_H
+#define _COMPAT_KTIME_H
+
+#include <linux/kernel.h>
+#include <time.h>
+
+static inline u64 ktime_get_ns(void){
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef _COMPAT_SLAB_H
+#define _COMPAT_SLAB_H
+
+#include <linux/gfp.h>
+
+static inline void *kzalloc(size_t size, int flags){
+  return calloc(1, size);
+}
+
+static inline void kfree(const void *p){
+  free((void *)p);
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef _COMPAT_SPI_H
+#define _COMPAT_SPI_H
+
+// the spi api of the spi backend, served by the bus of hc595Model.c
+
+#include <linux/kernel.h>
+
+#define SPI_MODE_0    0
+#define SPI_NAME_SIZE 32
+
+struct spi_master {
+  int bus_num;
+};
+
+struct spi_device {
+  struct spi_master *master;
+  u32 max_speed_hz;
+  u16 chip_select;
+  u32 mode;
+};
+
+struct spi_board_info {
+  char modalias[SPI_NAME_SIZE];
+  u32 max_speed_hz;
+  u16 bus_num;
+  u16 chip_select;
+  u32 mode;
+};
+
+struct spi_transfer {
+  const void *tx_buf;
+  void *rx_buf;
+  unsigned len;
+  unsigned cs_change:1;
+  u16 delay_usecs;
+  u32 speed_hz;
+};
+
+struct spi_master *spi_busnum_to_master(u16 bus_num);
+void spi_master_put(struct spi_master *master);
+struct spi_device *spi_new_device(struct spi_master *master, struct spi_board_info *chip);
+void spi_unregister_device(struct spi_device *spi);
+int  spi_sync_transfer(struct spi_device *spi, struct spi_transfer *xfers, unsigned int num_xfers);
+
+#endif
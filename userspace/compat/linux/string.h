@@ -0,0 +1,2 @@
+#include <string.h>
+#include <linux/kernel.h>
@@ -0,0 +1,18 @@
+#ifndef _COMPAT_TRACEPOINT_H
+#define _COMPAT_TRACEPOINT_H
+
+// tracepoints are never enabled in userspace
+
+#include <linux/kernel.h>
+
+#define TP_PROTO(...) __VA_ARGS__
+#define TP_ARGS(...) __VA_ARGS__
+
+#define DECLARE_EVENT_CLASS(name, proto, args, tstruct, assign, print)
+#define DEFINE_EVENT(template, name, proto, args)			\
+  static inline void trace_##name(proto) {}				\
+  static inline bool trace_##name##_enabled(void) { return false; }
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print)		\
+  DEFINE_EVENT(name, name, TP_PROTO(proto), TP_ARGS(args))
+
+#endif
@@ -0,0 +1 @@
+// nothing to create, see linux/tracepoint.h
@@ -0,0 +1,82 @@
+#include "hc595Model.h"
+#include "hd44780Model.h"
+#include "spiRoutines.h"
+#include <linux/spi/spi.h>
+#include <stdlib.h>
+
+#define HC595_CS    4
+#define HC595_CS_NS 100   // chip select setup and hold around a transfer
+
+// one shift register, the device has to come first
+struct lcd_hc595 {
+  struct spi_device spi;
+  struct lcd panel;            // display on lcd_model_ops
+};
+
+unsigned int lcd_hc595_khz = LCD_SPI_KHZ;
+
+static struct spi_master hc595_master = { .bus_num = 0 };
+static struct lcd_hc595 *hc595_registers[HC595_CS];
+
+struct spi_master *spi_busnum_to_master(u16 bus_num){
+  return (bus_num == hc595_master.bus_num) ? &hc595_master : NULL;
+}
+
+void spi_master_put(struct spi_master *master){
+}
+
+// The outputs are undefined after power on, modeled as all high
+struct spi_device *spi_new_device(struct spi_master *master, struct spi_board_info *chip){
+  struct lcd_hc595 *hc595;
+
+  if (chip->chip_select >= HC595_CS || hc595_registers[chip->chip_select]) {
+    return NULL;
+  }
+  hc595 = calloc(1, sizeof(*hc595));
+  if (!hc595) {
+    return NULL;
+  }
+  hc595->spi.master = master;
+  hc595->spi.max_speed_hz = min(chip->max_speed_hz, lcd_hc595_khz * 1000);
+  hc595->spi.chip_select = chip->chip_select;
+  hc595->spi.mode = chip->mode;
+  hc595->panel.pin.nbus = 4;
+  if (lcd_model_ops.init(&hc595->panel)) {
+    free(hc595);
+    return NULL;
+  }
+  hc595_registers[chip->chip_select] = hc595;
+  return &hc595->spi;
+}
+
+void spi_unregister_device(struct spi_device *spi){
+  struct lcd_hc595 *hc595 = (struct lcd_hc595 *)spi;
+
+  hc595_registers[spi->chip_select] = NULL;
+  lcd_model_ops.uninit(&hc595->panel);
+  free(hc595);
+}
+
+// One message, chip select rises after a transfer with cs_change and at the end unless the last has it
+int spi_sync_transfer(struct spi_device *spi, struct spi_transfer *xfers, unsigned int num_xfers){
+  struct lcd_hc595 *hc595 = (struct lcd_hc595 *)spi;
+  u64 bit_ns = 1000000000ULL / spi->max_speed_hz;
+  unsigned int i;
+
+  for (i = 0; i < num_xfers; i++) {
+    if (xfers[i].len == 0) {
+      return -EINVAL;
+    }
+    lcd_model_clock += HC595_CS_NS + xfers[i].len * 8 * bit_ns;
+    if (xfers[i].cs_change != (i == num_xfers - 1)) {
+      lcd_model_clock += HC595_CS_NS;
+      lcdModel_setPort(&hc595->panel, ((const unsigned char *)xfers[i].tx_buf)[xfers[i].len - 1]);
+    }
+    lcd_model_clock += (u64)xfers[i].delay_usecs * 1000;
+  }
+  return 0;
+}
+
+struct lcd *lcdHc595_getPanel(unsigned short cs){
+  return (cs < HC595_CS && hc595_registers[cs]) ? &hc595_registers[cs]->panel : NULL;
+}
@@ -0,0 +1,16 @@
+#ifndef _HC595MODEL_H
+#define _HC595MODEL_H
+
+#include "lcdroutines.h"
+
+/**
+ *  SPI bus 0 with a 74HC595 behind every chip select, serves the spi api of
+ *  the spi backend. The register takes over the last byte shifted in when
+ *  chip select rises at lcd_model_clock and drives an HD44780 model on its
+ *  panel, see lcdModel_setPort().
+ */
+extern unsigned int lcd_hc595_khz;   // clock of the modeled bus, the device may ask for less
+
+struct lcd *lcdHc595_getPanel(unsigned short cs);
+
+#endif
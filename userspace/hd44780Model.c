@@ -0,0 +1,519 @@
+#include "hd44780Model.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// the gpio backend waits 1us address setup before raising enable, see lcdGpio_pulse()
+#define MODEL_SETUP_NS   1000
+// a read holds enable high and low for 1us per transfer, see lcdGpio_readNbits()
+#define MODEL_READ_NS    2000
+// power on until the first instruction is accepted, VCC at 2.7V
+#define MODEL_POWERUP_US 40000
+// violations printed per display, the rest is only counted
+#define MODEL_REPORTS    10
+
+// initialization by instruction, HD44780U datasheet figures 23 and 24
+enum lcd_model_init {
+  MODEL_POWERUP,       // waiting for the first function set
+  MODEL_FS1,           // one 8 bit function set received, wait 4.1ms
+  MODEL_FS2,           // two received, wait 100us
+  MODEL_READY,         // handshake done, the busy flag is valid
+};
+
+struct lcd_model {
+  u64 now;                     // ns since power on, gpio calls take no time
+  u64 power_on;                // lcd_model_clock at power on
+  u64 busy_until;              // ns, end of the running instruction
+  u64 last_rise;               // ns, last rising edge of enable
+  enum lcd_model_init init;
+
+  unsigned char lines;         // data lines as set by set_lines()
+  bool rs;
+  bool eightbit;               // interface data length
+  bool half;                   // 4 bit interface, high nibble received
+  unsigned char nibble;
+  unsigned char port;          // outputs of a backpack, see lcdModel_setPort()
+  u64 port_rise;               // ns, rising edge of enable on the port, 0: none seen
+
+  unsigned char ddram[LCD_DDRAM_SIZE];
+  unsigned char cgram[64];
+  unsigned char ac;            // address counter
+  bool cgram_addr;             // ac points into CGRAM
+  unsigned char function;
+  unsigned char control;
+  unsigned char mode;
+  int shift;                   // display shift, positive to the right
+
+  unsigned long instructions;
+  unsigned long violations;
+};
+
+u64 lcd_model_clock;
+
+struct lcd_model_timing lcd_model_timing = {
+  .clear = 1520,
+  .home = 1520,
+  .command = 37,
+  .data = 41,       // 37us plus 4us until the address counter is updated
+  .pw_eh = 450,
+  .t_cyc = 1000,
+  .slowdown = 0,
+};
+
+static int  lcdModel_init(struct lcd *lcd);
+static void lcdModel_uninit(struct lcd *lcd);
+static void lcdModel_setLines(struct lcd *lcd, unsigned char value, bool rs);
+static void lcdModel_pulse(struct lcd *lcd);
+static void lcdModel_delay(struct lcd *lcd, unsigned int us);
+static unsigned char lcdModel_read(struct lcd *lcd, bool rs);
+
+static void lcdModel_violation(struct lcd_model *model, const char *fmt, ...)
+  __attribute__((format(printf, 2, 3)));
+static void lcdModel_latch(struct lcd_model *model, unsigned char value);
+static void lcdModel_execute(struct lcd_model *model, unsigned char value, bool rs);
+static void lcdModel_busy(struct lcd_model *model, unsigned int us);
+static void lcdModel_step(struct lcd_model *model, bool right);
+
+const struct lcd_bus_ops lcd_model_ops = {
+  .name = "hd44780 model",
+  .init = lcdModel_init,
+  .uninit = lcdModel_uninit,
+  .set_lines = lcdModel_setLines,
+  .pulse = lcdModel_pulse,
+  .delay = lcdModel_delay,
+  .read = lcdModel_read,
+};
+
+static int lcdModel_init(struct lcd *lcd){
+  struct lcd_model *model;
+
+  model = calloc(1, sizeof(*model));
+  if (!model) {
+    return -ENOMEM;
+  }
+  // the content after power on is undefined, anything but a blank is a hint
+  memset(model->ddram, '?', sizeof(model->ddram));
+  memset(model->cgram, 0x15, sizeof(model->cgram));
+  model->eightbit = true;
+  model->mode = LCD_ENTRYLEFT;
+  model->power_on = lcd_model_clock;
+  model->port = 0xFF;
+  model->busy_until = (u64)MODEL_POWERUP_US * 1000;
+  lcd->bus_data = model;
+  return 0;
+}
+
+static void lcdModel_uninit(struct lcd *lcd){
+  free(lcd->bus_data);
+  lcd->bus_data = NULL;
+}
+
+static void lcdModel_setLines(struct lcd *lcd, unsigned char value, bool rs){
+  struct lcd_model *model = lcd->bus_data;
+
+  lcd->stats.gpio_calls++;
+  // with 4 data lines only D7-D4 are wired
+  model->lines = (lcd->pin.nbus == 4) ? (value & 0x0F) << 4 : value;
+  model->rs = rs;
+}
+
+static void lcdModel_pulse(struct lcd *lcd){
+  struct lcd_model *model = lcd->bus_data;
+  u64 rise;
+
+  model->now += MODEL_SETUP_NS;
+  rise = model->now;
+  if (model->last_rise && rise - model->last_rise < lcd_model_timing.t_cyc) {
+    lcdModel_violation(model, "enable cycle of %llu ns, minimum %u ns",
+		       (unsigned long long)(rise - model->last_rise), lcd_model_timing.t_cyc);
+  }
+  model->last_rise = rise;
+
+  model->now += (u64)lcd->timing.pulse * 1000;
+  if (model->now - rise < lcd_model_timing.pw_eh) {
+    lcdModel_violation(model, "enable pulse of %llu ns, minimum %u ns",
+		       (unsigned long long)(model->now - rise), lcd_model_timing.pw_eh);
+  }
+  lcd->stats.gpio_calls += 2;
+
+  // written data is taken over on the falling edge
+  lcdModel_latch(model, model->lines);
+}
+
+static void lcdModel_delay(struct lcd *lcd, unsigned int us){
+  struct lcd_model *model = lcd->bus_data;
+
+  if (us < LCD_SLEEP_MIN_US) {
+    lcd->stats.spun_us += us;
+  }
+  else {
+    lcd->stats.slept_us += us;
+  }
+  model->now += (u64)us * 1000;
+}
+
+/**
+ *  @brief Set the outputs of a backpack the panel is wired to, see LCD_PORT_RS
+ *  The outputs change at lcd_model_clock. Data is taken over on the falling
+ *  edge of enable with the lines as they were, RS has to be stable before
+ *  the rising edge.
+ */
+void lcdModel_setPort(struct lcd *panel, unsigned char port){
+  struct lcd_model *model = panel->bus_data;
+  unsigned char changed = model->port ^ port;
+  u64 now = lcd_model_clock - model->power_on;
+
+  if (now > model->now) {
+    model->now = now;
+  }
+  if ((changed & LCD_PORT_RW) && (port & LCD_PORT_RW)) {
+    lcdModel_violation(model, "RW raised on the port, reads are not modeled");
+  }
+
+  if ((changed & LCD_PORT_ENABLE) && (port & LCD_PORT_ENABLE)) {
+    if (changed & LCD_PORT_RS) {
+      lcdModel_violation(model, "RS changes with the rising edge of enable");
+    }
+    if (model->last_rise && model->now - model->last_rise < lcd_model_timing.t_cyc) {
+      lcdModel_violation(model, "enable cycle of %llu ns, minimum %u ns",
+			 (unsigned long long)(model->now - model->last_rise), lcd_model_timing.t_cyc);
+    }
+    model->port_rise = model->last_rise = model->now;
+  }
+  else if ((changed & LCD_PORT_ENABLE) && model->port_rise) {
+    if (model->now - model->port_rise < lcd_model_timing.pw_eh) {
+      lcdModel_violation(model, "enable pulse of %llu ns, minimum %u ns",
+			 (unsigned long long)(model->now - model->port_rise), lcd_model_timing.pw_eh);
+    }
+    model->rs = model->port & LCD_PORT_RS;
+    model->lines = model->port & 0xF0;
+    lcdModel_latch(model, model->lines);
+  }
+  model->port = port;
+}
+
+// Busy flag and address counter (rs false) or data at the address counter
+static unsigned char lcdModel_read(struct lcd *lcd, bool rs){
+  struct lcd_model *model = lcd->bus_data;
+  unsigned char value;
+
+  lcd->stats.gpio_calls += 2 * lcd->pin.nbus + 3;
+  if (model->half) {
+    lcdModel_violation(model, "read between the nibbles of a write");
+    model->half = false;
+  }
+  model->now += model->eightbit ? MODEL_READ_NS : 2 * MODEL_READ_NS;
+  model->last_rise = model->now;
+
+  if (!rs) {
+    if (model->init != MODEL_READY) {
+      lcdModel_violation(model, "busy flag read before the initialization is done");
+    }
+    value = model->cgram_addr ? (model->ac & 0x3F) : (model->ac & 0x7F);
+    if (model->now < model->busy_until) {
+      value |= LCD_BUSYFLAG;
+    }
+    return value;
+  }
+
+  if (model->now < model->busy_until) {
+    lcdModel_violation(model, "data read while busy, %llu ns early",
+		       (unsigned long long)(model->busy_until - model->now));
+  }
+  value = model->cgram_addr ? model->cgram[model->ac & 0x3F] : model->ddram[model->ac & 0x7F];
+  lcdModel_step(model, model->mode & LCD_ENTRYLEFT);
+  lcdModel_busy(model, lcd_model_timing.data);
+  return value;
+}
+
+static void lcdModel_violation(struct lcd_model *model, const char *fmt, ...){
+  va_list args;
+
+  model->violations++;
+  if (model->violations > MODEL_REPORTS) {
+    return;
+  }
+  fprintf(stderr, "model: %llu.%03llu ms: ",
+	  (unsigned long long)(model->now / 1000000), (unsigned long long)(model->now / 1000 % 1000));
+  va_start(args, fmt);
+  vfprintf(stderr, fmt, args);
+  va_end(args);
+  fputc('\n', stderr);
+  if (model->violations == MODEL_REPORTS) {
+    fprintf(stderr, "model: further violations are only counted\n");
+  }
+}
+
+// One transfer on the falling edge of enable, a byte or a nibble
+static void lcdModel_latch(struct lcd_model *model, unsigned char value){
+  if (model->now < model->busy_until) {
+    lcdModel_violation(model, "%s 0x%02x while busy, %llu ns early",
+		       model->rs ? "data" : "instruction", value,
+		       (unsigned long long)(model->busy_until - model->now));
+  }
+
+  if (model->eightbit) {
+    lcdModel_execute(model, value, model->rs);
+    return;
+  }
+  if (!model->half) {
+    model->nibble = value & 0xF0;
+    model->half = true;
+    return;
+  }
+  model->half = false;
+  lcdModel_execute(model, model->nibble | (value >> 4), model->rs);
+}
+
+static void lcdModel_execute(struct lcd_model *model, unsigned char value, bool rs){
+  model->instructions++;
+
+  // until the handshake is done only function sets with DL = 1 are accepted
+  if (model->init != MODEL_READY) {
+    if (rs || (value & 0xF0) != (LCD_FUNCTIONSET | LCD_8BITMODE)) {
+      lcdModel_violation(model, "%s 0x%02x during the initialization handshake",
+			 rs ? "data" : "instruction", value);
+      return;
+    }
+    switch (model->init) {
+    case MODEL_POWERUP:
+      model->init = MODEL_FS1;
+      lcdModel_busy(model, 4100);
+      break;
+    case MODEL_FS1:
+      model->init = MODEL_FS2;
+      lcdModel_busy(model, 100);
+      break;
+    default:
+      model->init = MODEL_READY;
+      model->function = value;
+      lcdModel_busy(model, lcd_model_timing.command);
+      break;
+    }
+    return;
+  }
+
+  if (rs) {
+    if (model->cgram_addr) {
+      model->cgram[model->ac & 0x3F] = value & 0x1F;
+    }
+    else {
+      model->ddram[model->ac & 0x7F] = value;
+    }
+    lcdModel_step(model, model->mode & LCD_ENTRYLEFT);
+    if (!model->cgram_addr && (model->mode & LCD_ENTRYSHIFTINCREMENT)) {
+      model->shift += (model->mode & LCD_ENTRYLEFT) ? -1 : 1;
+    }
+    lcdModel_busy(model, lcd_model_timing.data);
+    return;
+  }
+
+  if (value & LCD_SETDDRAMADDR) {
+    model->ac = value & 0x7F;
+    model->cgram_addr = false;
+    if (model->function & LCD_2LINE ? (model->ac & 0x3F) >= 40 : model->ac >= 80) {
+      lcdModel_violation(model, "DDRAM address 0x%02x does not exist", model->ac);
+    }
+  }
+  else if (value & LCD_SETCGRAMADDR) {
+    model->ac = value & 0x3F;
+    model->cgram_addr = true;
+  }
+  else if (value & LCD_FUNCTIONSET) {
+    model->eightbit = value & LCD_8BITMODE;
+    model->function = value;
+  }
+  else if (value & LCD_CURSORSHIFT) {
+    if (value & LCD_DISPLAYMOVE) {
+      model->shift += (value & LCD_MOVERIGHT) ? 1 : -1;
+    }
+    else {
+      lcdModel_step(model, value & LCD_MOVERIGHT);
+    }
+  }
+  else if (value & LCD_DISPLAYCONTROL) {
+    model->control = value & 0x07;
+  }
+  else if (value & LCD_ENTRYMODESET) {
+    model->mode = value & 0x03;
+  }
+  else if (value & LCD_RETURNHOME) {
+    model->ac = 0;
+    model->cgram_addr = false;
+    model->shift = 0;
+    lcdModel_busy(model, lcd_model_timing.home);
+    return;
+  }
+  else if (value & LCD_CLEARDISPLAY) {
+    memset(model->ddram, ' ', sizeof(model->ddram));
+    model->ac = 0;
+    model->cgram_addr = false;
+    model->shift = 0;
+    model->mode |= LCD_ENTRYLEFT;
+    lcdModel_busy(model, lcd_model_timing.clear);
+    return;
+  }
+  lcdModel_busy(model, lcd_model_timing.command);
+}
+
+static void lcdModel_busy(struct lcd_model *model, unsigned int us){
+  model->busy_until = model->now + (u64)us * (100 + lcd_model_timing.slowdown) * 10;
+}
+
+// Move the address counter, DDRAM wraps around within the lines
+static void lcdModel_step(struct lcd_model *model, bool right){
+  if (model->cgram_addr) {
+    model->ac = (model->ac + (right ? 1 : -1)) & 0x3F;
+  }
+  else if (!(model->function & LCD_2LINE)) {
+    model->ac = right ? (model->ac + 1) % 80 : (model->ac + 79) % 80;
+  }
+  else if (right) {
+    model->ac = (model->ac == 0x27) ? 0x40 : (model->ac == 0x67) ? 0x00 : model->ac + 1;
+  }
+  else {
+    model->ac = (model->ac == 0x40) ? 0x27 : (model->ac == 0x00) ? 0x67 : model->ac - 1;
+  }
+}
+
+unsigned long lcdModel_getInstructions(struct lcd *lcd){
+  struct lcd_model *model = lcd->bus_data;
+
+  return model->instructions;
+}
+
+unsigned long lcdModel_getViolations(struct lcd *lcd){
+  struct lcd_model *model = lcd->bus_data;
+
+  return model->violations;
+}
+
+/**
+ *  @brief Compare the modeled controller with the committed frame
+ *  Checks every cell of the frame, the CGRAM of visible glyphs, the address
+ *  counter and the display flags, and prints the first differences.
+ *  @param panel display on lcd_model_ops, lcd itself unless a port expander is in between
+ *  @return number of differences, 0 if the panel shows the frame
+ */
+int lcdModel_verify(struct lcd *lcd, struct lcd *panel){
+  struct lcd_model *model = panel->bus_data;
+  struct lcd_marquee *marquee = &lcd->next_marquee;
+  int width = (model->function & LCD_2LINE) ? 40 : 80;
+  unsigned char row, col, addr, c, g, base, view = 0;
+  int i = 0, errors = 0;
+
+#define MODEL_MISMATCH(...)						\
+  do {									\
+    if (errors++ < MODEL_REPORTS) {					\
+      fprintf(stderr, "model: " __VA_ARGS__);				\
+    }									\
+  } while (0)
+
+  // the frame is shown at the shift lcd_flush() chose, a shift of lcd_shift() moves the frame
+  if (((width - model->shift % width) % width) != lcd->frame.shift) {
+    MODEL_MISMATCH("display shift %d, the driver assumes %u\n", model->shift, lcd->frame.shift);
+  }
+  if (marquee->active || lcd->frame.shift_owned) {
+    view = lcd->frame.shift;
+  }
+  if (marquee->active) {
+    base = lcd->cursor.row_offsets[marquee->row];
+    for (col = 0; col < width; col++) {
+      c = marquee->text[(marquee->step + col) % marquee->period];
+      addr = base + (marquee->step + col) % width;
+      if (model->ddram[addr] != c) {
+	MODEL_MISMATCH("marquee cell 0x%02x holds 0x%02x instead of 0x%02x\n", addr, model->ddram[addr], c);
+      }
+    }
+  }
+
+  for (row = 0; row < lcd->cursor.row_max; row++) {
+    base = (model->function & LCD_2LINE) ? (lcd->cursor.row_offsets[row] & 0x40) : 0;
+    for (col = 0; col < lcd->cursor.col_max; col++, i++) {
+      addr = base + (lcd->cursor.row_offsets[row] - base + col + view) % width;
+      c = model->ddram[addr];
+      g = lcd->frame.next_glyph[i];
+      if (g && lcd->glyph.slot[g - 1]) {
+	if (c >= 16 || (c & 0x07) != lcd->glyph.slot[g - 1] - 1) {
+	  MODEL_MISMATCH("row %u col %u shows 0x%02x, glyph %u is in slot %u\n",
+			 row, col, c, g - 1, lcd->glyph.slot[g - 1] - 1);
+	}
+	else if (memcmp(&model->cgram[(c & 0x07) * 8], lcd->glyph.bitmap[g - 1], 8)) {
+	  MODEL_MISMATCH("row %u col %u, CGRAM slot %u does not hold glyph %u\n",
+			 row, col, c & 0x07, g - 1);
+	}
+      }
+      else if (c != lcd->frame.next[i]) {
+	MODEL_MISMATCH("row %u col %u shows 0x%02x instead of 0x%02x\n",
+		       row, col, c, lcd->frame.next[i]);
+      }
+    }
+  }
+
+  if (model->cgram_addr || model->ac != lcd->frame.next_addr) {
+    MODEL_MISMATCH("address counter %s 0x%02x, the cursor is at 0x%02x\n",
+		   model->cgram_addr ? "CGRAM" : "DDRAM", model->ac, lcd->frame.next_addr);
+  }
+  if (model->control != lcd->display.control) {
+    MODEL_MISMATCH("display control 0x%02x instead of 0x%02x\n", model->control, lcd->display.control);
+  }
+  if (model->mode != lcd->display.mode) {
+    MODEL_MISMATCH("entry mode 0x%02x instead of 0x%02x\n", model->mode, lcd->display.mode);
+  }
+  if ((model->function & 0x1F) != lcd->display.function) {
+    MODEL_MISMATCH("function 0x%02x instead of 0x%02x\n", model->function & 0x1F, lcd->display.function);
+  }
+#undef MODEL_MISMATCH
+
+  return errors;
+}
+
+// Print what the panel shows, with the display shift applied
+void lcdModel_dump(struct lcd *lcd, struct lcd *panel){
+  struct lcd_model *model = panel->bus_data;
+  int width = (model->function & LCD_2LINE) ? 40 : 80;
+  unsigned char row, col, base, c;
+
+  for (row = 0; row < lcd->cursor.row_max; row++) {
+    base = (model->function & LCD_2LINE) ? (lcd->cursor.row_offsets[row] & 0x40) : 0;
+    fputc('|', stderr);
+    for (col = 0; col < lcd->cursor.col_max; col++) {
+      int pos = ((lcd->cursor.row_offsets[row] - base + col - model->shift) % width + width) % width;
+
+      c = model->ddram[base + pos];
+      fputc(c < 16 ? '0' + (c & 0x07) : (c < 0x80 ? c : '#'), stderr);
+    }
+    fputs("|\n", stderr);
+  }
+}
+
+// Change random DDRAM cells like a glitch on the lines would, see lcd_resync()
+void lcdModel_corrupt(struct lcd *panel, unsigned int cells){
+  struct lcd_model *model = panel->bus_data;
+  unsigned char addr;
+
+  while (cells--) {
+    addr = rand() % LCD_DDRAM_CELLS;
+    if ((model->function & LCD_2LINE) && addr >= 40) {
+      addr += 0x40 - 40;
+    }
+    model->ddram[addr] ^= 1 + rand() % 0x7F;
+  }
+}
+
+// Reset the controller like a brown-out does, by the internal reset circuit
+void lcdModel_reset(struct lcd *panel){
+  struct lcd_model *model = panel->bus_data;
+
+  memset(model->ddram, ' ', sizeof(model->ddram));
+  memset(model->cgram, 0x15, sizeof(model->cgram));
+  model->init = MODEL_READY;
+  model->eightbit = true;
+  model->half = false;
+  model->ac = 0;
+  model->cgram_addr = false;
+  model->function = LCD_FUNCTIONSET | LCD_8BITMODE;
+  model->control = 0;
+  model->mode = LCD_ENTRYLEFT;
+  model->shift = 0;
+}
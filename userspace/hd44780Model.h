@@ -0,0 +1,43 @@
+#ifndef _HD44780MODEL_H
+#define _HD44780MODEL_H
+
+#include "lcdroutines.h"
+
+// execution times of the modeled controller, HD44780U datasheet at fosc = 270kHz
+struct lcd_model_timing {
+  unsigned int clear;     // us
+  unsigned int home;      // us
+  unsigned int command;   // us
+  unsigned int data;      // us, write to DDRAM or CGRAM
+  unsigned int pw_eh;     // ns, minimum enable pulse width
+  unsigned int t_cyc;     // ns, minimum enable cycle time
+  unsigned int slowdown;  // percent added to the execution times, oscillator tolerance
+};
+
+/**
+ *  Display bus that drives a model of the controller instead of a panel.
+ *  The model follows the transitions the gpio backend would produce, including
+ *  the initialization handshake and the 4 bit nibble order, keeps DDRAM, CGRAM,
+ *  address counter, entry mode and display shift, and reports every
+ *  instruction sent while the modeled controller is still busy.
+ */
+extern const struct lcd_bus_ops lcd_model_ops;
+extern struct lcd_model_timing lcd_model_timing;
+
+/**
+ *  Time in ns of the modeled backpacks, which drive the model through
+ *  lcdModel_setPort() instead of the bus ops. The waits of the serial
+ *  backends pass on it, see compat/linux/delay.h.
+ */
+extern u64 lcd_model_clock;
+
+void lcdModel_setPort(struct lcd *panel, unsigned char port);
+
+unsigned long lcdModel_getInstructions(struct lcd *lcd);
+unsigned long lcdModel_getViolations(struct lcd *lcd);
+int  lcdModel_verify(struct lcd *lcd, struct lcd *panel);
+void lcdModel_dump(struct lcd *lcd, struct lcd *panel);
+void lcdModel_corrupt(struct lcd *panel, unsigned int cells);
+void lcdModel_reset(struct lcd *panel);
+
+#endif
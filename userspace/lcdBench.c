@@ -0,0 +1,533 @@
+/**
+ * @file lcdBench.c
+ * @brief Replays typical workloads through lcdroutines.c on the mock bus.
+ *
+ * Every workload renders, commits and flushes a number of frames and reports
+ * per frame what the gpio backend would have done: gpio calls, enable pulses,
+ * bytes sent and the modeled bus time, see mockRoutines.h for the cost model.
+ *
+ * Each workload runs twice, with the update planner of lcd_flush() and with
+ * the row by row rewrite, the saved bus time is reported.
+ *
+ * With -v the workloads drive the HD44780 model of hd44780Model.c instead.
+ * Every frame is then checked against what the model shows, and every
+ * instruction sent while the modeled controller is busy is reported. The exit
+ * status is 1 if anything was found, so timings can be tightened with -t.
+ * With -e cells of the model are changed after every frame, lcd_resync() has
+ * to find and repair them before the frame is checked. With -R the model is
+ * reset like by a brown-out every so many frames, lcd_resync() has to notice
+ * and initialize it again.
+ *
+ * With -i the display sits on a PCF8574 i2c backpack, see pcf8574Model.h,
+ * with -S on a 74HC595 on spi, see hc595Model.h. The serial backends are
+ * measured by the bytes on the wire per byte sent and the time the transfers
+ * and waits take on the bus.
+ */
+
+#include "hc595Model.h"
+#include "hd44780Model.h"
+#include "i2cRoutines.h"
+#include "lcdroutines.h"
+#include "mockRoutines.h"
+#include "pcf8574Model.h"
+#include "spiRoutines.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct bench_workload {
+  const char *name;
+  const char *help;
+  int  (*setup)(struct lcd *lcd);
+  void (*frame)(struct lcd *lcd, unsigned int i);
+};
+
+static struct lcd_config bench_config = {
+  .cols = 20,
+  .rows = 4,
+  .fourbitmode = 0,
+  .rs = 66,
+  .rw = 255,
+  .enable = 67,
+  .data = {69, 68, 45, 44, 26, 47, 46, 27},
+  .controller = "hd44780",
+  .bus = &lcd_mock_ops,
+};
+
+static bool bench_verify = false;
+static bool bench_i2c = false;
+static bool bench_spi = false;
+static bool bench_plan = true;
+static bool bench_failed = false;
+static bool bench_timing_set = false;
+static unsigned int bench_glitch = 0;
+static unsigned int bench_brownout = 0;
+static struct lcd_timing bench_timing;
+
+/****** workloads ******/
+
+// every cell changes, e.g. switching between menu pages
+static void bench_redraw(struct lcd *lcd, unsigned int i){
+  char text[LCD_FRAME_SIZE];
+  size_t n = 0;
+  unsigned char row, col;
+
+  for (row = 0; row < lcd_getRows(lcd); row++) {
+    for (col = 0; col < lcd_getCols(lcd); col++) {
+      text[n++] = 'A' + (i + row + col) % 26;
+    }
+    text[n++] = '\n';
+  }
+  lcd_render(lcd, "\0", 1);
+  lcd_render(lcd, text, n);
+}
+
+// a seconds counter in a static screen, one or two cells change
+static int bench_clockSetup(struct lcd *lcd){
+  lcd_render(lcd, "\e", 1);
+  lcd_render(lcd, "Uptime\nHH:MM:SS", 15);
+  return 0;
+}
+
+static void bench_clock(struct lcd *lcd, unsigned int i){
+  char text[16];
+  int n;
+
+  n = snprintf(text, sizeof(text), "%02u:%02u:%02u", i / 3600 % 24, i / 60 % 60, i % 60);
+  lcd_moveCursor(lcd, 0, 1);
+  lcd_render(lcd, text, n);
+}
+
+// a menu switching screens, each starts with a clear and shows a short title
+static void bench_reset(struct lcd *lcd, unsigned int i){
+  static const char *titles[] = { "Settings", "Network", "Status", "About" };
+  const char *title = titles[i % 4];
+
+  lcd_render(lcd, "\e", 1);
+  lcd_render(lcd, (char *)title, strlen(title));
+}
+
+// a log, each line moves one row up and a new line is added at the bottom
+static void bench_log(struct lcd *lcd, unsigned int i){
+  char text[LCD_FRAME_SIZE];
+  size_t n = 0;
+  unsigned int row, rows = lcd_getRows(lcd);
+
+  for (row = 0; row < rows; row++) {
+    unsigned int line = i + row;
+    n += snprintf(text + n, sizeof(text) - n, "%04u event %-*s\n", line,
+		  lcd_getCols(lcd) - 11, (line % 3) ? "ok" : "warning");
+  }
+  lcd_render(lcd, "\e", 1);
+  lcd_render(lcd, text, n);
+}
+
+// twelve animated glyphs, more than the controller has slots for
+#define BENCH_GLYPHS 12
+
+static int bench_glyphSetup(struct lcd *lcd){
+  unsigned char bitmap[8];
+  unsigned int g, line;
+
+  for (g = 0; g < BENCH_GLYPHS; g++) {
+    for (line = 0; line < 8; line++) {
+      bitmap[line] = (line <= g % 8) ? 0x1F : 0x00;   // bar graph levels
+    }
+    bitmap[0] ^= g >> 3;
+    lcd_registerGlyph(lcd, g, bitmap, '0' + g % 10);
+  }
+  lcd_render(lcd, "\e", 1);
+  lcd_render(lcd, "Spectrum", 8);
+  return 0;
+}
+
+static void bench_glyph(struct lcd *lcd, unsigned int i){
+  unsigned int col;
+
+  lcd_moveCursor(lcd, 0, 1);
+  for (col = 0; col < 8; col++) {
+    lcd_renderGlyph(lcd, (i * 5 + col * 7) % BENCH_GLYPHS);
+  }
+}
+
+// localized UTF-8 text, translated by the character set, umlauts and the euro sign need glyphs
+static void bench_utf8(struct lcd *lcd, unsigned int i){
+  char text[LCD_FRAME_SIZE * 3];
+  int n;
+
+  n = snprintf(text, sizeof(text), "\eTemp %2u.%u\xc2\xb0""C \xc2\xb5%u\nK\xc3\xbchler \xe2\x86\x92 %s\n"
+	       "\xc3\x84nderung %u\xe2\x82\xac\n\xef\xbd\xb1\xef\xbd\xb2 \xce\xa9 \xcf\x80 \xe2\x88\x9e",
+	       20 + i % 10, i % 10, i % 100, (i % 2) ? "an" : "aus", i % 50);
+  lcd_render(lcd, text, min(n, (int)sizeof(text) - 1));
+}
+
+// a news ticker in the first row, longer than a DDRAM line
+static const char bench_news[] = "+++ Lcd: the display shift scrolls a whole DDRAM line with one "
+  "instruction, the text only has to be loaded once +++";
+
+// scrolled by rewriting the row, one column per frame
+static void bench_ticker(struct lcd *lcd, unsigned int i){
+  size_t period = sizeof(bench_news) - 1 + LCD_MARQUEE_GAP;
+  unsigned char col;
+  char c;
+
+  lcd_moveCursor(lcd, 0, 0);
+  for (col = 0; col < lcd_getCols(lcd); col++) {
+    size_t k = (i + col) % period;
+
+    c = (k < sizeof(bench_news) - 1) ? bench_news[k] : ' ';
+    lcd_render(lcd, &c, 1);
+  }
+}
+
+// scrolled by the display shift
+static int bench_marqueeSetup(struct lcd *lcd){
+  lcd_render(lcd, "\e", 1);
+  return lcd_setMarquee(lcd, 0, bench_news, sizeof(bench_news) - 1);
+}
+
+static void bench_marquee(struct lcd *lcd, unsigned int i){
+  lcd_stepMarquee(lcd);
+}
+
+static const struct bench_workload bench_workloads[] = {
+  { "redraw", "full screen redraw",            NULL,              bench_redraw },
+  { "clock",  "clock tick",                    bench_clockSetup,  bench_clock  },
+  { "reset",  "clear and a short title",       NULL,              bench_reset  },
+  { "log",    "scrolling log",                 NULL,              bench_log    },
+  { "glyph",  "custom glyph animation",        bench_glyphSetup,  bench_glyph  },
+  { "utf8",   "localized text, A00 ROM",       NULL,              bench_utf8   },
+  { "ticker", "ticker rewritten every step",   NULL,              bench_ticker },
+  { "marquee", "ticker by display shift, 1-2 rows", bench_marqueeSetup, bench_marquee },
+};
+
+/****** runner ******/
+
+// Display the HD44780 model runs on, the one behind the backpack with -i or -S
+static struct lcd *bench_panel(struct lcd *lcd){
+  if (bench_i2c) {
+    return lcdPcf_getPanel(lcd->link.addr);
+  }
+  return bench_spi ? lcdHc595_getPanel(lcd->link.addr) : lcd;
+}
+
+static u64 bench_busNs(struct lcd *lcd){
+  return (bench_i2c || bench_spi) ? lcd_model_clock : lcdMock_getBusNs(lcd);
+}
+
+// Run the workload on the controller model, check every frame
+static int bench_runVerify(struct lcd *lcd, const struct bench_workload *workload, unsigned int frames){
+  unsigned long instructions = lcdModel_getInstructions(bench_panel(lcd));
+  unsigned long bytes = 0, found = 0;
+  unsigned int i, bad = 0, errors, resets = 0;
+  struct lcd_stats start, stats;
+  bool reset;
+  int ret;
+
+  errors = lcdModel_verify(lcd, bench_panel(lcd));
+  bad += !!errors;
+  for (i = 0; i < frames; i++) {
+    workload->frame(lcd, i);
+    lcd_commit(lcd);
+    lcd_flush(lcd);
+    if (bench_glitch || bench_brownout) {
+      lcdModel_corrupt(bench_panel(lcd), bench_glitch);
+      reset = bench_brownout && i % bench_brownout == bench_brownout - 1;
+      if (reset) {
+	lcdModel_reset(bench_panel(lcd));
+	resets++;
+      }
+      lcd_getStats(lcd, &start);
+      ret = lcd_resync(lcd);
+      if (ret < 0) {
+	fprintf(stderr, "%s: lcd_resync failed (%d)\n", workload->name, ret);
+	bench_failed = true;
+	break;
+      }
+      lcd_getStats(lcd, &stats);
+      bytes += stats.bytes - start.bytes;
+      // after a reset every cell counts as repaired
+      found += reset ? 0 : ret;
+    }
+    errors = lcdModel_verify(lcd, bench_panel(lcd));
+    if (errors && !bad) {
+      fprintf(stderr, "model: %s frame %u differs, the panel shows\n", workload->name, i);
+      lcdModel_dump(lcd, bench_panel(lcd));
+    }
+    bad += !!errors;
+  }
+
+  printf("%-8s %11.1f %11lu %11u   %s\n", workload->name,
+	 (double)(lcdModel_getInstructions(bench_panel(lcd)) - instructions) / frames,
+	 lcdModel_getViolations(bench_panel(lcd)), bad, workload->help);
+  if (bench_glitch || bench_brownout) {
+    printf("%-8s %lu of %u changed cells repaired, %u resets, %.1f bytes sent per read back\n", "",
+	   found, bench_glitch * (frames - resets), resets, (double)bytes / frames);
+  }
+  bench_failed |= bad || lcdModel_getViolations(bench_panel(lcd));
+
+  lcd_uninit(lcd);
+  free(lcd);
+  return 0;
+}
+
+// Set up a display for the workload, 1 if the workload does not run on it
+static int bench_open(const struct bench_workload *workload, bool plan, struct lcd **lcdp){
+  struct lcd *lcd;
+  int ret;
+
+  lcd = calloc(1, sizeof(*lcd));
+  if (!lcd) {
+    return -ENOMEM;
+  }
+  ret = lcd_init(lcd, &bench_config);
+  if (ret) {
+    free(lcd);
+    return ret;
+  }
+  if (bench_timing_set) {
+    lcd_setTiming(lcd, &bench_timing);
+  }
+  lcd_setPlanner(lcd, plan);
+
+  if (workload->setup) {
+    ret = workload->setup(lcd);
+    if (ret) {
+      printf("%-8s not supported on this display (%d)\n", workload->name, ret);
+      lcd_uninit(lcd);
+      free(lcd);
+      return 1;
+    }
+  }
+  lcd_commit(lcd);
+  lcd_flush(lcd);
+  *lcdp = lcd;
+  return 0;
+}
+
+// Run the workload on the mock bus or the backpack, the stats and the bus time of the frames
+static int bench_measure(const struct bench_workload *workload, unsigned int frames, bool plan,
+			 struct lcd_stats *stats, u64 *bus_ns){
+  struct lcd *lcd;
+  struct lcd_stats start;
+  unsigned int i;
+  int ret;
+
+  ret = bench_open(workload, plan, &lcd);
+  if (ret) {
+    return ret;
+  }
+  lcd_getStats(lcd, &start);
+  *bus_ns = bench_busNs(lcd);
+  for (i = 0; i < frames; i++) {
+    workload->frame(lcd, i);
+    lcd_commit(lcd);
+    lcd_flush(lcd);
+  }
+  lcd_getStats(lcd, stats);
+  *bus_ns = bench_busNs(lcd) - *bus_ns;
+  stats->gpio_calls -= start.gpio_calls;
+  stats->bus_bytes -= start.bus_bytes;
+  stats->transfers -= start.transfers;
+  stats->pulses -= start.pulses;
+  stats->bytes -= start.bytes;
+
+  lcd_uninit(lcd);
+  free(lcd);
+  return 0;
+}
+
+static int bench_run(const struct bench_workload *workload, unsigned int frames){
+  struct lcd *lcd;
+  struct lcd_stats stats, naive;
+  u64 bus_ns, naive_ns;
+  int ret;
+
+  if (bench_verify) {
+    ret = bench_open(workload, bench_plan, &lcd);
+    return (ret > 0) ? 0 : ret ? ret : bench_runVerify(lcd, workload, frames);
+  }
+
+  // the same frames rewritten row by row, what the planner is measured against
+  ret = bench_measure(workload, frames, false, &naive, &naive_ns);
+  if (ret == 0) {
+    ret = bench_measure(workload, frames, true, &stats, &bus_ns);
+  }
+  if (ret) {
+    return (ret > 0) ? 0 : ret;
+  }
+
+  if (bench_i2c || bench_spi) {
+    printf("%-8s %11.1f %11.1f %11.1f %11.2f %12.1f %12.1f %6.1f%%   %s\n", workload->name,
+	   (double)stats.bus_bytes / frames,
+	   (double)stats.transfers / frames,
+	   (double)stats.bytes / frames,
+	   stats.bytes ? (double)stats.bus_bytes / stats.bytes : 0.0,
+	   (double)bus_ns / frames / 1000.0,
+	   (double)naive_ns / frames / 1000.0,
+	   naive_ns ? 100.0 * ((double)naive_ns - (double)bus_ns) / naive_ns : 0.0,
+	   workload->help);
+    return 0;
+  }
+  printf("%-8s %11.1f %11.1f %11.1f %12.1f %12.1f %6.1f%%   %s\n", workload->name,
+	 (double)stats.gpio_calls / frames,
+	 (double)stats.pulses / frames,
+	 (double)stats.bytes / frames,
+	 (double)bus_ns / frames / 1000.0,
+	 (double)naive_ns / frames / 1000.0,
+	 naive_ns ? 100.0 * ((double)naive_ns - (double)bus_ns) / naive_ns : 0.0,
+	 workload->help);
+  return 0;
+}
+
+static void bench_usage(const char *prog){
+  unsigned int i;
+
+  fprintf(stderr, "usage: %s [-n frames] [-g COLSxROWS] [-4] [-c controller] [-t clear,home,command,data,pulse]\n"
+	  "       [-i kHz | -S kHz] [-v [-r [-e cells] [-R frames]] [-s slowdown%%] [-N]] [workload...]\n", prog);
+  fprintf(stderr, "  -t  override the execution times of the controller profile, in us\n");
+  fprintf(stderr, "  -i  display on a PCF8574 i2c backpack at the given clock, always 4 bit\n");
+  fprintf(stderr, "  -S  display on a 74HC595 on spi at the given clock, always 4 bit\n");
+  fprintf(stderr, "  -v  verify on the HD44780 model instead of measuring, -r wires RW for the busy flag,\n"
+	  "      -s makes the modeled controller slower, e.g. for a low oscillator frequency,\n"
+	  "      -N verifies the row by row rewrite instead of the planner,\n"
+	  "      -e changes cells of the model after every frame for lcd_resync() to repair,\n"
+	  "      -R resets the model every so many frames for lcd_resync() to initialize again\n");
+  fprintf(stderr, "workloads:\n");
+  for (i = 0; i < sizeof(bench_workloads) / sizeof(bench_workloads[0]); i++) {
+    fprintf(stderr, "  %-8s %s\n", bench_workloads[i].name, bench_workloads[i].help);
+  }
+}
+
+int main(int argc, char **argv){
+  unsigned int frames = 1000, cols, rows, i;
+  size_t count = sizeof(bench_workloads) / sizeof(bench_workloads[0]);
+  int opt, ret = 0;
+
+  while ((opt = getopt(argc, argv, "n:g:4c:t:i:S:vrs:Ne:R:h")) != -1) {
+    switch (opt) {
+    case 'n':
+      frames = strtoul(optarg, NULL, 0);
+      break;
+    case 'g':
+      if (sscanf(optarg, "%ux%u", &cols, &rows) != 2 ||
+	  cols == 0 || cols > LCD_MAX_COLS || rows == 0 || rows > LCD_MAX_ROWS) {
+	fprintf(stderr, "bad geometry %s\n", optarg);
+	return 2;
+      }
+      bench_config.cols = cols;
+      bench_config.rows = rows;
+      break;
+    case '4':
+      bench_config.fourbitmode = 1;
+      break;
+    case 'c':
+      bench_config.controller = optarg;
+      break;
+    case 't':
+      if (sscanf(optarg, "%u,%u,%u,%u,%u", &bench_timing.clear, &bench_timing.home,
+		 &bench_timing.command, &bench_timing.data, &bench_timing.pulse) != 5) {
+	fprintf(stderr, "bad timing %s\n", optarg);
+	return 2;
+      }
+      bench_timing.name = "custom";
+      bench_timing_set = true;
+      break;
+    case 'i':
+      lcd_pcf_khz = strtoul(optarg, NULL, 0);
+      if (lcd_pcf_khz == 0 || lcd_pcf_khz > 3400) {
+	fprintf(stderr, "bad i2c clock %s\n", optarg);
+	return 2;
+      }
+      bench_i2c = true;
+      break;
+    case 'S':
+      lcd_hc595_khz = strtoul(optarg, NULL, 0);
+      if (lcd_hc595_khz == 0 || lcd_hc595_khz > 50000) {
+	fprintf(stderr, "bad spi clock %s\n", optarg);
+	return 2;
+      }
+      bench_spi = true;
+      break;
+    case 'v':
+      bench_verify = true;
+      bench_config.bus = &lcd_model_ops;
+      break;
+    case 'r':
+      bench_config.rw = 65;
+      break;
+    case 's':
+      lcd_model_timing.slowdown = strtoul(optarg, NULL, 0);
+      break;
+    case 'N':
+      bench_plan = false;
+      break;
+    case 'e':
+      bench_glitch = strtoul(optarg, NULL, 0);
+      break;
+    case 'R':
+      bench_brownout = strtoul(optarg, NULL, 0);
+      break;
+    default:
+      bench_usage(argv[0]);
+      return 2;
+    }
+  }
+  if (frames == 0) {
+    frames = 1;
+  }
+  // the model sits behind the backpack, RW is held low by the backend
+  if (bench_i2c && bench_spi) {
+    fprintf(stderr, "either -i or -S\n");
+    return 2;
+  }
+  // only the gpio backend reads the display
+  if ((bench_glitch || bench_brownout) && (!bench_verify || bench_config.rw == 255 || bench_i2c || bench_spi)) {
+    fprintf(stderr, "-e and -R need -v and -r on the gpio bus\n");
+    return 2;
+  }
+  if (bench_i2c || bench_spi) {
+    bench_config.bus = bench_i2c ? &lcd_i2c_ops : &lcd_spi_ops;
+    bench_config.fourbitmode = 1;
+    bench_config.rw = 255;
+    bench_config.port = 0;
+    bench_config.addr = bench_i2c ? LCD_I2C_ADDR : 0;
+    bench_config.khz = bench_i2c ? lcd_pcf_khz : lcd_hc595_khz;
+  }
+
+  printf("%ux%u, %d bit bus, %s, %u frames, ", bench_config.cols, bench_config.rows,
+	 bench_config.fourbitmode ? 4 : 8, bench_timing_set ? "custom timing" : bench_config.controller, frames);
+  if (bench_verify) {
+    printf("%s%s, %s, %u%% slower\n", bench_config.bus->name, (bench_i2c || bench_spi) ? " to the model" : "",
+	   bench_config.rw != 255 ? "busy flag" : "fixed delays", lcd_model_timing.slowdown);
+    printf("%-8s %11s %11s %11s\n", "workload", "instr/frame", "violations", "bad frames");
+  }
+  else if (bench_i2c || bench_spi) {
+    printf("%s at %u kHz\n", bench_config.bus->name, bench_config.khz);
+    printf("%-8s %11s %11s %11s %11s %12s %12s %7s\n", "workload", "wire/frame", "xfer/frame", "byte/frame",
+	   "wire/byte", "bus us/frame", "row by row", "saved");
+  }
+  else {
+    printf("gpio call %u ns\n", LCD_MOCK_GPIO_NS);
+    printf("%-8s %11s %11s %11s %12s %12s %7s\n", "workload", "gpio/frame", "pulse/frame", "byte/frame",
+	   "bus us/frame", "row by row", "saved");
+  }
+
+  for (i = 0; i < count; i++) {
+    int j, selected = (optind == argc);
+
+    for (j = optind; j < argc; j++) {
+      selected |= !strcmp(argv[j], bench_workloads[i].name);
+    }
+    if (!selected) {
+      continue;
+    }
+    ret = bench_run(&bench_workloads[i], frames);
+    if (ret) {
+      fprintf(stderr, "%s: lcd_init failed (%d)\n", bench_workloads[i].name, ret);
+      break;
+    }
+  }
+  return (ret || bench_failed) ? 1 : 0;
+}
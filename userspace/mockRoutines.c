@@ -0,0 +1,92 @@
+#include "mockRoutines.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct lcd_mock {
+  u64 bus_ns;   // modeled time spent on the bus, gpio calls and waits
+};
+
+static int  lcdMock_init(struct lcd *lcd);
+static void lcdMock_uninit(struct lcd *lcd);
+static void lcdMock_setLines(struct lcd *lcd, unsigned char value, bool rs);
+static void lcdMock_pulse(struct lcd *lcd);
+static void lcdMock_delay(struct lcd *lcd, unsigned int us);
+static void lcdMock_gpio(struct lcd *lcd, unsigned int calls);
+
+// no read, lcdroutines.c waits the execution times like with RW on ground
+const struct lcd_bus_ops lcd_mock_ops = {
+  .name = "mock",
+  .init = lcdMock_init,
+  .uninit = lcdMock_uninit,
+  .set_lines = lcdMock_setLines,
+  .pulse = lcdMock_pulse,
+  .delay = lcdMock_delay,
+};
+
+static int lcdMock_init(struct lcd *lcd){
+  lcd->bus_data = calloc(1, sizeof(struct lcd_mock));
+  if (!lcd->bus_data) {
+    return -ENOMEM;
+  }
+  return 0;
+}
+
+static void lcdMock_uninit(struct lcd *lcd){
+  free(lcd->bus_data);
+  lcd->bus_data = NULL;
+}
+
+// one gpiod_set_array_value() call like the gpio backend
+static void lcdMock_setLines(struct lcd *lcd, unsigned char value, bool rs){
+  lcdMock_gpio(lcd, 1);
+}
+
+static void lcdMock_pulse(struct lcd *lcd){
+  lcdMock_delay(lcd, 1);
+  lcdMock_gpio(lcd, 1);
+  lcdMock_delay(lcd, lcd->timing.pulse);
+  lcdMock_gpio(lcd, 1);
+}
+
+static void lcdMock_delay(struct lcd *lcd, unsigned int us){
+  struct lcd_mock *mock = lcd->bus_data;
+
+  if (us < LCD_SLEEP_MIN_US) {
+    lcd->stats.spun_us += us;
+  }
+  else {
+    lcd->stats.slept_us += us;
+  }
+  mock->bus_ns += (u64)us * 1000;
+}
+
+static void lcdMock_gpio(struct lcd *lcd, unsigned int calls){
+  struct lcd_mock *mock = lcd->bus_data;
+
+  lcd->stats.gpio_calls += calls;
+  mock->bus_ns += (u64)calls * LCD_MOCK_GPIO_NS;
+}
+
+u64 lcdMock_getBusNs(struct lcd *lcd){
+  struct lcd_mock *mock = lcd->bus_data;
+
+  return mock->bus_ns;
+}
+
+// the kernel log of lcdroutines.c, only what would be worth a look in dmesg
+int printk(const char *fmt, ...){
+  va_list args;
+  int ret;
+
+  if (fmt[0] == '<' && fmt[1] > '4') {
+    return 0;
+  }
+  if (fmt[0] == '<') {
+    fmt += 3;
+  }
+  va_start(args, fmt);
+  ret = vfprintf(stderr, fmt, args);
+  va_end(args);
+  return ret;
+}
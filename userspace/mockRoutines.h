@@ -0,0 +1,14 @@
+#ifndef _MOCKROUTINES_H
+#define _MOCKROUTINES_H
+
+#include "lcdroutines.h"
+
+// cost model of the gpio backend without a fast path, gpiod calls on a BeagleBone
+#define LCD_MOCK_GPIO_NS 1500
+
+// display without a bus, counts what the gpio backend would do
+extern const struct lcd_bus_ops lcd_mock_ops;
+
+u64 lcdMock_getBusNs(struct lcd *lcd);
+
+#endif
@@ -0,0 +1,74 @@
+#include "pcf8574Model.h"
+#include "hd44780Model.h"
+#include "i2cRoutines.h"
+#include <linux/i2c.h>
+#include <stdlib.h>
+
+#define PCF_ADDRS 0x80
+
+// one backpack, the client has to come first
+struct lcd_pcf {
+  struct i2c_client client;
+  struct lcd panel;            // display on lcd_model_ops
+};
+
+unsigned int lcd_pcf_khz = LCD_I2C_KHZ;
+
+static struct i2c_adapter pcf_adapter = { .nr = 0 };
+static struct lcd_pcf *pcf_backpacks[PCF_ADDRS];
+
+struct i2c_adapter *i2c_get_adapter(int nr){
+  return (nr == pcf_adapter.nr) ? &pcf_adapter : NULL;
+}
+
+void i2c_put_adapter(struct i2c_adapter *adapter){
+}
+
+// A backpack powers up with all outputs high, the panel with it
+struct i2c_client *i2c_new_dummy(struct i2c_adapter *adapter, u16 address){
+  struct lcd_pcf *pcf;
+
+  if (address >= PCF_ADDRS || pcf_backpacks[address]) {
+    return NULL;
+  }
+  pcf = calloc(1, sizeof(*pcf));
+  if (!pcf) {
+    return NULL;
+  }
+  pcf->client.addr = address;
+  pcf->client.adapter = adapter;
+  pcf->panel.pin.nbus = 4;
+  if (lcd_model_ops.init(&pcf->panel)) {
+    free(pcf);
+    return NULL;
+  }
+  pcf_backpacks[address] = pcf;
+  return &pcf->client;
+}
+
+void i2c_unregister_device(struct i2c_client *client){
+  struct lcd_pcf *pcf = (struct lcd_pcf *)client;
+
+  pcf_backpacks[client->addr] = NULL;
+  lcd_model_ops.uninit(&pcf->panel);
+  free(pcf);
+}
+
+// Start, address and stop take 11 bit times, every byte 9 and reaches the outputs with its acknowledge
+int i2c_master_send(const struct i2c_client *client, const char *buf, int count){
+  struct lcd_pcf *pcf = (struct lcd_pcf *)client;
+  u64 bit_ns = 1000000 / lcd_pcf_khz;
+  int i;
+
+  lcd_model_clock += 10 * bit_ns;
+  for (i = 0; i < count; i++) {
+    lcd_model_clock += 9 * bit_ns;
+    lcdModel_setPort(&pcf->panel, buf[i]);
+  }
+  lcd_model_clock += bit_ns;
+  return count;
+}
+
+struct lcd *lcdPcf_getPanel(unsigned short addr){
+  return (addr < PCF_ADDRS && pcf_backpacks[addr]) ? &pcf_backpacks[addr]->panel : NULL;
+}
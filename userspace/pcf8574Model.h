@@ -0,0 +1,16 @@
+#ifndef _PCF8574MODEL_H
+#define _PCF8574MODEL_H
+
+#include "lcdroutines.h"
+
+/**
+ *  I2C adapter 0 with a PCF8574 backpack behind every address, serves the
+ *  i2c api of the i2c backend. Each byte of a transfer reaches the outputs
+ *  after its acknowledge at lcd_model_clock and drives an HD44780 model on
+ *  the backpack's panel, see lcdModel_setPort().
+ */
+extern unsigned int lcd_pcf_khz;   // clock of the modeled adapter
+
+struct lcd *lcdPcf_getPanel(unsigned short addr);
+
+#endif